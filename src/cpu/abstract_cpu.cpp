@@ -30,14 +30,14 @@
 #include <limits.h>
 #include "cpu.h"
 #include "../lib.h"
+#include "../perf/perf_record.h"
 
 abstract_cpu::~abstract_cpu()
 {
 	unsigned int i=0;
-	for (i=0; i < cstates.size(); i++){
-		delete cstates[i];
-	}
+
 	cstates.clear();
+	delete [] cstate_pool;
 
 	for (i=0; i < pstates.size(); i++){
 		delete pstates[i];
@@ -91,6 +91,36 @@ void abstract_cpu::freq_updated(uint64_t time)
 	old_idle = idle;
 }
 
+/*
+ * The children only touch their own state while taking a snapshot, so the
+ * sysfs and MSR reads of sibling cpus/cores/packages can run side by side.
+ */
+static void child_measurement_start(unsigned int index, void *arg)
+{
+	vector<class abstract_cpu *> *children = (vector<class abstract_cpu *> *)arg;
+
+	if ((*children)[index])
+		(*children)[index]->measurement_start();
+}
+
+static void child_measurement_end(unsigned int index, void *arg)
+{
+	vector<class abstract_cpu *> *children = (vector<class abstract_cpu *> *)arg;
+
+	if ((*children)[index])
+		(*children)[index]->measurement_end();
+}
+
+void abstract_cpu::children_measurement_start(void)
+{
+	parallel_for(children.size(), child_measurement_start, &children);
+}
+
+void abstract_cpu::children_measurement_end(void)
+{
+	parallel_for(children.size(), child_measurement_end, &children);
+}
+
 void abstract_cpu::measurement_start(void)
 {
 	unsigned int i;
@@ -99,9 +129,15 @@ void abstract_cpu::measurement_start(void)
 
 	last_stamp = 0;
 
-	for (i = 0; i < cstates.size(); i++)
-		delete cstates[i];
-	cstates.resize(0);
+	/* the states themselves stay, only their counters start over */
+	for (i = 0; i < cstates.size(); i++) {
+		struct idle_state *state = cstates[i];
+
+		state->usage_before = state->usage_after = state->usage_delta = 0;
+		state->duration_before = state->duration_after = state->duration_delta = 0;
+		state->before_count = state->after_count = 0;
+	}
+	cstate_hint = 0;
 
 	for (i = 0; i < pstates.size(); i++)
 		delete pstates[i];
@@ -120,9 +156,7 @@ void abstract_cpu::measurement_start(void)
 		file.close();
 	}
 
-	for (i = 0; i < children.size(); i++)
-		if (children[i])
-			children[i]->measurement_start();
+	children_measurement_start();
 
 	gettimeofday(&stamp_before, NULL);
 
@@ -147,9 +181,7 @@ void abstract_cpu::measurement_end(void)
 	time_factor = 1000000.0 * (stamp_after.tv_sec - stamp_before.tv_sec) + stamp_after.tv_usec - stamp_before.tv_usec;
 
 
-	for (i = 0; i < children.size(); i++)
-		if (children[i])
-			children[i]->measurement_end();
+	children_measurement_end();
 
 	for (i = 0; i < children.size(); i++)
 		if (children[i]) {
@@ -159,8 +191,13 @@ void abstract_cpu::measurement_end(void)
 				if (!state)
 					continue;
 
-				update_cstate( state->linux_name, state->human_name, state->usage_before, state->duration_before, state->before_count);
-				finalize_cstate(state->linux_name,                   state->usage_after,  state->duration_after,  state->after_count);
+				if (state->parent_slot < 0)
+					state->parent_slot = get_cstate(state->linux_name, state->human_name, -1);
+				if (state->parent_slot < 0)
+					continue;
+
+				update_cstate_idx(  state->parent_slot, state->usage_before, state->duration_before, state->before_count);
+				finalize_cstate_idx(state->parent_slot, state->usage_after,  state->duration_after,  state->after_count);
 			}
 			for (j = 0; j < children[i]->pstates.size(); j++) {
 				struct frequency *state;
@@ -187,15 +224,47 @@ void abstract_cpu::measurement_end(void)
 	}
 }
 
-void abstract_cpu::insert_cstate(const char *linux_name, const char *human_name, uint64_t usage, uint64_t duration, int count, int level)
+/*
+ * States are looked up by their cpuidle/MSR name; the readers walk them in
+ * the same order every window, so try the slot after the last hit first.
+ */
+int abstract_cpu::find_cstate(const char *linux_name)
+{
+	unsigned int i;
+
+	if (cstate_hint < cstates.size() && strcmp(linux_name, cstates[cstate_hint]->linux_name) == 0)
+		return cstate_hint++;
+
+	for (i = 0; i < cstates.size(); i++) {
+		if (strcmp(linux_name, cstates[i]->linux_name) == 0) {
+			cstate_hint = i + 1;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/* find a state, creating it (with zeroed counters) on first use */
+int abstract_cpu::get_cstate(const char *linux_name, const char *human_name, int level)
 {
 	struct idle_state *state;
 	const char *c;
+	int idx;
 
-	state = new(std::nothrow) struct idle_state;
+	idx = find_cstate(linux_name);
+	if (idx >= 0)
+		return idx;
 
-	if (!state)
-		return;
+	if (!cstate_pool) {
+		cstate_pool = new(std::nothrow) struct idle_state[MAX_CSTATES];
+		if (!cstate_pool)
+			return -1;
+	}
+	if (cstates.size() >= MAX_CSTATES)
+		return -1;
+
+	state = &cstate_pool[cstates.size()];
 
 	memset(state, 0, sizeof(*state));
 
@@ -205,6 +274,7 @@ void abstract_cpu::insert_cstate(const char *linux_name, const char *human_name,
 	pt_strcpy(state->human_name, human_name);
 
 	state->line_level = -1;
+	state->parent_slot = -1;
 
 	c = human_name;
 	while (*c) {
@@ -243,54 +313,61 @@ void abstract_cpu::insert_cstate(const char *linux_name, const char *human_name,
 	if (level >= 0)
 		state->line_level = level;
 
-	state->usage_before = usage;
-	state->duration_before = duration;
-	state->before_count = count;
+	idx = cstates.size() - 1;
+	cstate_hint = idx + 1;
+	return idx;
 }
 
-void abstract_cpu::finalize_cstate(const char *linux_name, uint64_t usage, uint64_t duration, int count)
+void abstract_cpu::insert_cstate(const char *linux_name, const char *human_name, uint64_t usage, uint64_t duration, int count, int level)
 {
-	unsigned int i;
-	struct idle_state *state = NULL;
+	int idx;
 
-	for (i = 0; i < cstates.size(); i++) {
-		if (strcmp(linux_name, cstates[i]->linux_name) == 0) {
-			state = cstates[i];
-			break;
-		}
-	}
-
-	if (!state) {
-		cout << "Invalid C state finalize " << linux_name << " \n";
+	idx = get_cstate(linux_name, human_name, level);
+	if (idx < 0)
 		return;
-	}
+
+	update_cstate_idx(idx, usage, duration, count);
+}
+
+void abstract_cpu::update_cstate_idx(int idx, uint64_t usage, uint64_t duration, int count)
+{
+	struct idle_state *state = cstates[idx];
+
+	state->usage_before += usage;
+	state->duration_before += duration;
+	state->before_count += count;
+}
+
+void abstract_cpu::finalize_cstate_idx(int idx, uint64_t usage, uint64_t duration, int count)
+{
+	struct idle_state *state = cstates[idx];
 
 	state->usage_after += usage;
 	state->duration_after += duration;
 	state->after_count += count;
 }
 
-void abstract_cpu::update_cstate(const char *linux_name, const char *human_name, uint64_t usage, uint64_t duration, int count, int level)
+void abstract_cpu::finalize_cstate(const char *linux_name, uint64_t usage, uint64_t duration, int count)
 {
-	unsigned int i;
-	struct idle_state *state = NULL;
-
-	for (i = 0; i < cstates.size(); i++) {
-		if (strcmp(linux_name, cstates[i]->linux_name) == 0) {
-			state = cstates[i];
-			break;
-		}
-	}
+	int idx;
 
-	if (!state) {
-		insert_cstate(linux_name, human_name, usage, duration, count, level);
+	idx = find_cstate(linux_name);
+	if (idx < 0) {
+		cout << "Invalid C state finalize " << linux_name << " \n";
 		return;
 	}
 
-	state->usage_before += usage;
-	state->duration_before += duration;
-	state->before_count += count;
+	finalize_cstate_idx(idx, usage, duration, count);
+}
+
+int abstract_cpu::update_cstate(const char *linux_name, const char *human_name, uint64_t usage, uint64_t duration, int count, int level)
+{
+	int idx;
 
+	idx = get_cstate(linux_name, human_name, level);
+	if (idx >= 0)
+		update_cstate_idx(idx, usage, duration, count);
+	return idx;
 }
 
 int abstract_cpu::has_cstate_level(int level)
@@ -533,3 +610,131 @@ void abstract_cpu::reset_pstate_data(void)
 		if (children[i])
 			children[i]->reset_pstate_data();
 }
+
+void abstract_cpu::save_state(class trace_snapshot &snapshot)
+{
+	unsigned int i;
+
+	snapshot.put_double(time_factor);
+
+	snapshot.put_u32(cstates.size());
+	for (i = 0; i < cstates.size(); i++) {
+		struct idle_state *state = cstates[i];
+
+		snapshot.put_string(state->linux_name);
+		snapshot.put_string(state->human_name);
+		snapshot.put_u32(state->line_level);
+		snapshot.put_u64(state->usage_before);
+		snapshot.put_u64(state->usage_after);
+		snapshot.put_u64(state->usage_delta);
+		snapshot.put_u64(state->duration_before);
+		snapshot.put_u64(state->duration_after);
+		snapshot.put_u64(state->duration_delta);
+		snapshot.put_u32(state->before_count);
+		snapshot.put_u32(state->after_count);
+	}
+
+	snapshot.put_u32(pstates.size());
+	for (i = 0; i < pstates.size(); i++) {
+		struct frequency *state = pstates[i];
+
+		snapshot.put_string(state->human_name);
+		snapshot.put_u32(state->line_level);
+		snapshot.put_u64(state->freq);
+		snapshot.put_u64(state->time_after);
+		snapshot.put_u64(state->time_before);
+		snapshot.put_u32(state->before_count);
+		snapshot.put_u32(state->after_count);
+		snapshot.put_double(state->display_value);
+	}
+
+	snapshot.put_u32(children.size());
+	for (i = 0; i < children.size(); i++) {
+		snapshot.put_u32(children[i] != NULL);
+		if (children[i])
+			children[i]->save_state(snapshot);
+	}
+}
+
+/*
+ * The tree being loaded is built from the recorded topology, so it has the
+ * same shape; children it lacks (the GPU) are read into a throwaway node.
+ */
+void abstract_cpu::load_state(class trace_snapshot &snapshot)
+{
+	char linux_name[sizeof(cstates[0]->linux_name)];
+	char human_name[sizeof(cstates[0]->human_name)];
+	struct idle_state discard;
+	unsigned int i, count;
+	int idx, level;
+
+	time_factor = snapshot.get_double();
+	total_stamp = 0;
+
+	for (i = 0; i < cstates.size(); i++) {
+		struct idle_state *state = cstates[i];
+
+		state->usage_before = state->usage_after = state->usage_delta = 0;
+		state->duration_before = state->duration_after = state->duration_delta = 0;
+		state->before_count = state->after_count = 0;
+	}
+
+	count = snapshot.get_u32();
+	for (i = 0; i < count && !snapshot.failed(); i++) {
+		struct idle_state *state;
+
+		snapshot.get_string(linux_name, sizeof(linux_name));
+		snapshot.get_string(human_name, sizeof(human_name));
+		level = snapshot.get_u32();
+
+		idx = get_cstate(linux_name, human_name, level);
+		/* no room for another state; read past it */
+		state = idx >= 0 ? cstates[idx] : &discard;
+		state->line_level = level;
+		state->usage_before = snapshot.get_u64();
+		state->usage_after = snapshot.get_u64();
+		state->usage_delta = snapshot.get_u64();
+		state->duration_before = snapshot.get_u64();
+		state->duration_after = snapshot.get_u64();
+		state->duration_delta = snapshot.get_u64();
+		state->before_count = snapshot.get_u32();
+		state->after_count = snapshot.get_u32();
+	}
+
+	for (i = 0; i < pstates.size(); i++)
+		delete pstates[i];
+	pstates.resize(0);
+
+	count = snapshot.get_u32();
+	for (i = 0; i < count && !snapshot.failed(); i++) {
+		struct frequency *state;
+
+		state = new(std::nothrow) struct frequency;
+		if (!state)
+			return;
+		memset(state, 0, sizeof(*state));
+		pstates.push_back(state);
+
+		snapshot.get_string(state->human_name, sizeof(state->human_name));
+		state->line_level = snapshot.get_u32();
+		state->freq = snapshot.get_u64();
+		state->time_after = snapshot.get_u64();
+		state->time_before = snapshot.get_u64();
+		state->before_count = snapshot.get_u32();
+		state->after_count = snapshot.get_u32();
+		state->display_value = snapshot.get_double();
+	}
+
+	count = snapshot.get_u32();
+	for (i = 0; i < count && !snapshot.failed(); i++) {
+		if (!snapshot.get_u32())
+			continue;
+		if (i < children.size() && children[i]) {
+			children[i]->load_state(snapshot);
+		} else {
+			class abstract_cpu scratch;
+
+			scratch.load_state(snapshot);
+		}
+	}
+}
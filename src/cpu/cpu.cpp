@@ -37,6 +37,7 @@
 #include "../parameters/parameters.h"
 
 #include "../perf/perf_bundle.h"
+#include "../perf/perf_record.h"
 #include "../lib.h"
 #include "../display.h"
 #include "../report/report.h"
@@ -53,6 +54,8 @@ static	class perf_bundle * perf_events;
 
 class perf_power_bundle: public perf_bundle
 {
+public:
+	perf_power_bundle(void);
 	virtual void handle_trace_point(void *trace, int cpu, uint64_t time);
 
 };
@@ -82,6 +85,10 @@ static class abstract_cpu * new_package(int package, int cpu, char * vendor, int
 	ret->set_type("Package");
 	ret->childcount = 0;
 
+	/* a replay gets its devices from the recording */
+	if (trace_replaying())
+		return ret;
+
 	snprintf(packagename, sizeof(packagename), _("cpu package %i"), cpu);
 	cpudev = new class cpudevice(_("cpu package"), packagename, ret);
 	all_devices.push_back(cpudev);
@@ -162,33 +169,11 @@ static class abstract_cpu * new_cpu(int number, char * vendor, int family, int m
 
 
 
-static void handle_one_cpu(unsigned int number, char *vendor, int family, int model)
+static void add_cpu(unsigned int number, unsigned int package_number, unsigned int core_number,
+		    char *vendor, int family, int model)
 {
-	char filename[PATH_MAX];
-	ifstream file;
-	unsigned int package_number = 0;
-	unsigned int core_number = 0;
 	class abstract_cpu *package, *core, *cpu;
 
-	snprintf(filename, sizeof(filename), "/sys/devices/system/cpu/cpu%i/topology/core_id", number);
-	file.open(filename, ios::in);
-	if (file) {
-		file >> core_number;
-		if (core_number == (unsigned int) -1)
-			core_number = number;
-		file.close();
-	}
-
-	snprintf(filename, sizeof(filename), "/sys/devices/system/cpu/cpu%i/topology/physical_package_id", number);
-	file.open(filename, ios::in);
-	if (file) {
-		file >> package_number;
-		if (package_number == (unsigned int) -1)
-			package_number = 0;
-		file.close();
-	}
-
-
 	if (system_level.children.size() <= package_number)
 		system_level.children.resize(package_number + 1, NULL);
 
@@ -226,6 +211,34 @@ static void handle_one_cpu(unsigned int number, char *vendor, int family, int mo
 	all_cpus[number] = cpu;
 }
 
+static void handle_one_cpu(unsigned int number, char *vendor, int family, int model)
+{
+	char filename[PATH_MAX];
+	ifstream file;
+	unsigned int package_number = 0;
+	unsigned int core_number = 0;
+
+	snprintf(filename, sizeof(filename), "/sys/devices/system/cpu/cpu%i/topology/core_id", number);
+	file.open(filename, ios::in);
+	if (file) {
+		file >> core_number;
+		if (core_number == (unsigned int) -1)
+			core_number = number;
+		file.close();
+	}
+
+	snprintf(filename, sizeof(filename), "/sys/devices/system/cpu/cpu%i/topology/physical_package_id", number);
+	file.open(filename, ios::in);
+	if (file) {
+		file >> package_number;
+		if (package_number == (unsigned int) -1)
+			package_number = 0;
+		file.close();
+	}
+
+	add_cpu(number, package_number, core_number, vendor, family, model);
+}
+
 static void handle_i965_gpu(void)
 {
 	unsigned int core_number = 0;
@@ -246,7 +259,61 @@ static void handle_i965_gpu(void)
 }
 
 
-void enumerate_cpus(void)
+/* package, core and number of every cpu, for a replay to rebuild the tree */
+static void record_topology(void)
+{
+	class trace_snapshot snapshot;
+	class abstract_cpu *cpu;
+	unsigned int i;
+
+	for (i = 0; i < all_cpus.size(); i++) {
+		cpu = all_cpus[i];
+		if (!cpu || !cpu->parent || !cpu->parent->parent)
+			continue;
+		snapshot.put_u32(cpu->parent->parent->get_number());
+		snapshot.put_u32(cpu->parent->get_number());
+		snapshot.put_u32(cpu->get_number());
+		snapshot.put_u32(cpu->has_intel_MSR);
+	}
+	record_snapshot(SNAPSHOT_CPUS, snapshot);
+}
+
+/*
+ * The recorded tree is built from the generic classes: the model specific
+ * ones read MSRs and sysfs of the machine they run on. Their counters come
+ * from the window snapshots.
+ */
+static void enumerate_recorded_cpus(void)
+{
+	class trace_snapshot snapshot;
+	unsigned int package, core, number;
+	char vendor[1] = "";
+	bool msr;
+
+	if (replay_snapshot(SNAPSHOT_CPUS, snapshot)) {
+		while (1) {
+			package = snapshot.get_u32();
+			core = snapshot.get_u32();
+			number = snapshot.get_u32();
+			msr = snapshot.get_u32();
+			if (snapshot.failed())
+				break;
+			if (number >= trace_replay_cpus())
+				continue;
+
+			add_cpu(number, package, core, vendor, 0, 0);
+			all_cpus[number]->set_intel_MSR(msr);
+			all_cpus[number]->parent->set_intel_MSR(msr);
+			all_cpus[number]->parent->parent->set_intel_MSR(msr);
+		}
+	}
+
+	set_max_cpu(trace_replay_cpus() - 1);
+	if (all_cpus.size() < trace_replay_cpus())
+		all_cpus.resize(trace_replay_cpus(), NULL);
+}
+
+static int enumerate_local_cpus(void)
 {
 	ifstream file;
 	char line[4096];
@@ -259,7 +326,7 @@ void enumerate_cpus(void)
 	file.open("/proc/cpuinfo",  ios::in);
 
 	if (!file)
-		return;
+		return -1;
 	/* Not all /proc/cpuinfo include "vendor_id\t". */
 	vendor[0] = '\0';
 
@@ -324,9 +391,23 @@ void enumerate_cpus(void)
 
 	file.close();
 
+	open_msr_handles(get_max_cpu());
+
 	if (access("/sys/class/drm/card0/power/rc6_residency_ms", R_OK) == 0)
 		handle_i965_gpu();
 
+	if (trace_recording())
+		record_topology();
+	return 0;
+}
+
+void enumerate_cpus(void)
+{
+	if (trace_replaying())
+		enumerate_recorded_cpus();
+	else if (enumerate_local_cpus())
+		return;
+
 	perf_events = new perf_power_bundle();
 
 	if (!perf_events->add_event("power","cpu_idle")){
@@ -338,18 +419,31 @@ void enumerate_cpus(void)
 
 }
 
+/* in a replay the counters are read back from the snapshot instead */
 void start_cpu_measurement(void)
 {
 	perf_events->start();
-	system_level.measurement_start();
+	if (!trace_replaying())
+		system_level.measurement_start();
 }
 
 void end_cpu_measurement(void)
 {
-	system_level.measurement_end();
+	if (!trace_replaying())
+		system_level.measurement_end();
 	perf_events->stop();
 }
 
+void save_cpu_state(class trace_snapshot &snapshot)
+{
+	system_level.save_state(snapshot);
+}
+
+void load_cpu_state(class trace_snapshot &snapshot)
+{
+	system_level.load_state(snapshot);
+}
+
 static void expand_string(char *string, unsigned int newlen)
 {
 	while (strlen(string) < newlen)
@@ -971,67 +1065,93 @@ struct power_entry {
 } __attribute__((packed));
 
 
-void perf_power_bundle::handle_trace_point(void *trace, int cpunr, uint64_t time)
+static class abstract_cpu *trace_cpu(int cpunr)
 {
-	struct tep_event *event;
-        struct tep_record rec; /* holder */
-	class abstract_cpu *cpu;
-	int type;
+	if (cpunr >= (int)all_cpus.size()) {
+		cout << "INVALID cpu nr in handle_trace_point\n";
+		return NULL;
+	}
 
-	rec.data = trace;
+	return all_cpus[cpunr];
+}
 
-	type = tep_data_type(perf_event::tep, &rec);
-	event = tep_find_event(perf_event::tep, type);
+static void handle_cpu_idle(struct trace_dispatch *d, void *trace, int cpunr, uint64_t time)
+{
+	class abstract_cpu *cpu;
+	unsigned long long val;
 
-	if (!event)
+	cpu = trace_cpu(cpunr);
+	if (!cpu)
 		return;
 
-	if (cpunr >= (int)all_cpus.size()) {
-		cout << "INVALID cpu nr in handle_trace_point\n";
-		return;
+	if (trace_field_val(d, 0, trace, &val) < 0) {
+		fprintf(stderr, _("cpu_idle event returned no state?\n"));
+		exit(-1);
 	}
 
-	cpu = all_cpus[cpunr];
+	if (val == (unsigned int)-1)
+		cpu->go_unidle(time);
+	else
+		cpu->go_idle(time);
+}
 
-#if 0
-	unsigned int i;
-	printf("Time is %llu \n", time);
-	for (i = 0; i < system_level.children.size(); i++)
-		if (system_level.children[i])
-			system_level.children[i]->validate();
-#endif
+static void handle_cpu_frequency(struct trace_dispatch *d, void *trace, int cpunr, uint64_t time)
+{
+	class abstract_cpu *cpu;
 	unsigned long long val;
-	int ret;
-	if (strcmp(event->name, "cpu_idle")==0) {
-
-		ret = tep_get_field_val(NULL, event, "state", &rec, &val, 0);
-                if (ret < 0) {
-                        fprintf(stderr, _("cpu_idle event returned no state?\n"));
-                        exit(-1);
-                }
-
-		if (val == (unsigned int)-1)
-			cpu->go_unidle(time);
-		else
-			cpu->go_idle(time);
-	}
 
-	if (strcmp(event->name, "power_frequency") == 0
-	|| strcmp(event->name, "cpu_frequency") == 0){
-
-		ret = tep_get_field_val(NULL, event, "state", &rec, &val, 0);
-		if (ret < 0) {
-			fprintf(stderr, _("power or cpu_frequency event returned no state?\n"));
-			exit(-1);
-		}
+	cpu = trace_cpu(cpunr);
+	if (!cpu)
+		return;
 
-		cpu->change_freq(time, val);
+	if (trace_field_val(d, 0, trace, &val) < 0) {
+		fprintf(stderr, _("power or cpu_frequency event returned no state?\n"));
+		exit(-1);
 	}
 
-	if (strcmp(event->name, "power_start")==0)
+	cpu->change_freq(time, val);
+}
+
+static void handle_power_start(struct trace_dispatch *d, void *trace, int cpunr, uint64_t time)
+{
+	class abstract_cpu *cpu;
+
+	cpu = trace_cpu(cpunr);
+	if (cpu)
 		cpu->go_idle(time);
-	if (strcmp(event->name, "power_end")==0)
+}
+
+static void handle_power_end(struct trace_dispatch *d, void *trace, int cpunr, uint64_t time)
+{
+	class abstract_cpu *cpu;
+
+	cpu = trace_cpu(cpunr);
+	if (cpu)
 		cpu->go_unidle(time);
+}
+
+static const struct trace_point_desc power_trace_points[] = {
+	{ "cpu_idle",		handle_cpu_idle,	{ "state" } },
+	{ "cpu_frequency",	handle_cpu_frequency,	{ "state" } },
+	{ "power_frequency",	handle_cpu_frequency,	{ "state" } },
+	{ "power_start",	handle_power_start,	{ } },
+	{ "power_end",		handle_power_end,	{ } },
+	{ NULL, NULL, { } }
+};
+
+perf_power_bundle::perf_power_bundle(void) : perf_bundle(power_trace_points)
+{
+}
+
+void perf_power_bundle::handle_trace_point(void *trace, int cpunr, uint64_t time)
+{
+	struct trace_dispatch *d;
+
+	d = find_dispatch(trace);
+	if (!d || !d->handler)
+		return;
+
+	d->handler(d, trace, cpunr, time);
 
 #if 0
 	unsigned int i;
@@ -1076,4 +1196,5 @@ void clear_all_cpus(void)
 		delete all_cpus[i];
 	}
 	all_cpus.clear();
+	close_msr_handles();
 }
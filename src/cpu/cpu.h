@@ -32,9 +32,12 @@
 #include <stdint.h>
 #include <sys/time.h>
 
+#include "../lib.h"
+
 using namespace std;
 
 class abstract_cpu;
+class trace_snapshot;
 
 #define LEVEL_C0 -1
 #define LEVEL_HEADER -2
@@ -42,6 +45,8 @@ class abstract_cpu;
 #define PSTATE 1
 #define CSTATE 2
 
+#define MAX_CSTATES 64
+
 struct idle_state {
 	char linux_name[16]; /* state0 etc.. cpuidle name */
 	char human_name[32];
@@ -58,6 +63,7 @@ struct idle_state {
 	int after_count;
 
 	int line_level;
+	int parent_slot;	/* index of this state in the parent's cstates, -1 if not resolved yet */
 };
 
 struct frequency {
@@ -84,6 +90,16 @@ protected:
 	uint64_t max_frequency = 0;
 	uint64_t max_minus_one_frequency = 0;
 
+	/* cstates[] point into this, a state keeps its index for our lifetime */
+	struct idle_state *cstate_pool = NULL;
+	unsigned int	cstate_hint = 0;
+
+	void		children_measurement_start(void);
+	void		children_measurement_end(void);
+
+	int		find_cstate(const char *linux_name);
+	int		get_cstate(const char *linux_name, const char *human_name, int level);
+
 	virtual void	account_freq(uint64_t frequency, uint64_t duration);
 	virtual void	freq_updated(uint64_t time);
 
@@ -122,8 +138,10 @@ public:
 	/* C state related methods */
 
 	void		insert_cstate(const char *linux_name, const char *human_name, uint64_t usage, uint64_t duration, int count, int level = -1);
-	void		update_cstate(const char *linux_name, const char *human_name, uint64_t usage, uint64_t duration, int count, int level = -1);
+	int		update_cstate(const char *linux_name, const char *human_name, uint64_t usage, uint64_t duration, int count, int level = -1);
 	void		finalize_cstate(const char *linux_name, uint64_t usage, uint64_t duration, int count);
+	void		update_cstate_idx(int idx, uint64_t usage, uint64_t duration, int count);
+	void		finalize_cstate_idx(int idx, uint64_t usage, uint64_t duration, int count);
 
 	virtual int	has_cstate_level(int level);
 
@@ -158,18 +176,37 @@ public:
 
 	virtual void validate(void);
 	virtual void reset_pstate_data(void);
+
+	/* the counters of this cpu and everything below it, for --record/--replay */
+	void		save_state(class trace_snapshot &snapshot);
+	void		load_state(class trace_snapshot &snapshot);
 };
 
 extern vector<class abstract_cpu *> all_cpus;
 
+struct cpuidle_files {
+	char		linux_name[64];
+	char		human_name[64];
+	int		slot;		/* index in cstates, -1 until first seen */
+	sysfs_attr	usage;
+	sysfs_attr	time;
+};
+
 class cpu_linux: public abstract_cpu
 {
+	vector<struct cpuidle_files *> cpuidle;
+	bool	cpuidle_scanned;
+
+	void	scan_cpuidle(void);
 	void 	parse_pstates_start(void);
 	void 	parse_cstates_start(void);
 	void 	parse_pstates_end(void);
 	void 	parse_cstates_end(void);
 
 public:
+	cpu_linux(void) : cpuidle_scanned(false) {};
+	virtual ~cpu_linux(void);
+
 	virtual void	measurement_start(void);
 	virtual void	measurement_end(void);
 
@@ -231,4 +268,7 @@ extern void end_cpu_data(void);
 extern void clear_cpu_data(void);
 extern void clear_all_cpus(void);
 
+extern void save_cpu_state(class trace_snapshot &snapshot);
+extern void load_cpu_state(class trace_snapshot &snapshot);
+
 #endif
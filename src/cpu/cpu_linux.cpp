@@ -38,14 +38,29 @@
 #include <sys/stat.h>
 #include <dirent.h>
 
-void cpu_linux::parse_cstates_start(void)
+cpu_linux::~cpu_linux(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < cpuidle.size(); i++)
+		delete cpuidle[i];
+	cpuidle.clear();
+}
+
+/*
+ * The cpuidle states of a cpu do not change while we run; look them up
+ * once and keep their usage/time attributes open for the later windows.
+ */
+void cpu_linux::scan_cpuidle(void)
 {
-	ifstream file;
 	DIR *dir;
 	struct dirent *entry;
 	char filename[256];
+	string human;
 	int len;
 
+	cpuidle_scanned = true;
+
 	len = snprintf(filename, sizeof(filename), "/sys/devices/system/cpu/cpu%i/cpuidle", number);
 
 	dir = opendir(filename);
@@ -55,50 +70,55 @@ void cpu_linux::parse_cstates_start(void)
 	/* For each C-state, there is a stateX directory which
 	 * contains a 'usage' and a 'time' (duration) file */
 	while ((entry = readdir(dir))) {
-		char linux_name[64];
-		char human_name[64];
-		uint64_t usage = 0;
-		uint64_t duration = 0;
-
+		struct cpuidle_files *state;
 
 		if (strlen(entry->d_name) < 3)
 			continue;
 
-		pt_strcpy(linux_name, entry->d_name);
-		pt_strcpy(human_name, linux_name);
+		state = new struct cpuidle_files;
+		state->slot = -1;
+		pt_strcpy(state->linux_name, entry->d_name);
+		pt_strcpy(state->human_name, entry->d_name);
 
 		snprintf(filename + len, sizeof(filename) - len, "/%s/name", entry->d_name);
+		human = read_sysfs_string(filename);
+		if (human.length() > 0)
+			pt_strcpy(state->human_name, human.c_str());
 
-		file.open(filename, ios::in);
-		if (file) {
-			file.getline(human_name, sizeof(human_name));
-			file.close();
-		}
-
-		if (strcmp(human_name, "C0")==0)
-			pt_strcpy(human_name, _("C0 polling"));
+		if (strcmp(state->human_name, "C0")==0)
+			pt_strcpy(state->human_name, _("C0 polling"));
 
 		snprintf(filename + len, sizeof(filename) - len, "/%s/usage", entry->d_name);
-		file.open(filename, ios::in);
-		if (file) {
-			file >> usage;
-			file.close();
-		} else
-			continue;
-
+		state->usage.set_path(filename);
 		snprintf(filename + len, sizeof(filename) - len, "/%s/time", entry->d_name);
+		state->time.set_path(filename);
 
-		file.open(filename, ios::in);
-		if (file) {
-			file >> duration;
-			file.close();
-		}
+		cpuidle.push_back(state);
+	}
+	closedir(dir);
+}
 
+void cpu_linux::parse_cstates_start(void)
+{
+	unsigned int i;
+
+	if (!cpuidle_scanned)
+		scan_cpuidle();
 
-		update_cstate(linux_name, human_name, usage, duration, 1);
+	for (i = 0; i < cpuidle.size(); i++) {
+		struct cpuidle_files *state = cpuidle[i];
+		uint64_t usage = 0;
+		uint64_t duration = 0;
 
+		if (!state->usage.read_u64(&usage))
+			continue;
+		state->time.read_u64(&duration);
+
+		if (state->slot < 0)
+			state->slot = update_cstate(state->linux_name, state->human_name, usage, duration, 1);
+		else
+			update_cstate_idx(state->slot, usage, duration, 1);
 	}
-	closedir(dir);
 }
 
 
@@ -140,55 +160,20 @@ void cpu_linux::measurement_start(void)
 
 void cpu_linux::parse_cstates_end(void)
 {
-	DIR *dir;
-	struct dirent *entry;
-	char filename[256];
-	ifstream file;
-	int len;
-
-	len = snprintf(filename, sizeof(filename), "/sys/devices/system/cpu/cpu%i/cpuidle", number);
-
-	dir = opendir(filename);
-	if (!dir)
-		return;
+	unsigned int i;
 
-	/* For each C-state, there is a stateX directory which
-	 * contains a 'usage' and a 'time' (duration) file */
-	while ((entry = readdir(dir))) {
-		char linux_name[64];
-		char human_name[64];
+	for (i = 0; i < cpuidle.size(); i++) {
+		struct cpuidle_files *state = cpuidle[i];
 		uint64_t usage = 0;
 		uint64_t duration = 0;
 
-
-		if (strlen(entry->d_name) < 3)
-			continue;
-
-		pt_strcpy(linux_name, entry->d_name);
-		pt_strcpy(human_name, linux_name);
-
-
-		snprintf(filename + len, sizeof(filename) - len, "/%s/usage", entry->d_name);
-		file.open(filename, ios::in);
-		if (file) {
-			file >> usage;
-			file.close();
-		} else
+		if (!state->usage.read_u64(&usage))
 			continue;
+		state->time.read_u64(&duration);
 
-		snprintf(filename + len, sizeof(filename) - len, "/%s/time", entry->d_name);
-
-		file.open(filename, ios::in);
-		if (file) {
-			file >> duration;
-			file.close();
-		}
-
-
-		finalize_cstate(linux_name, usage, duration, 1);
-
+		if (state->slot >= 0)
+			finalize_cstate_idx(state->slot, usage, duration, 1);
 	}
-	closedir(dir);
 }
 
 void cpu_linux::parse_pstates_end(void)
@@ -37,19 +37,21 @@ using namespace std;
 class cpu_rapl_device: public cpudevice {
 
 	c_rapl_interface *rapl;
-	time_t		last_time;
+	uint64_t	last_time;
 	double		last_energy;
 	double 		consumed_power;
+	double		peak;
 	bool		device_valid;
 
 public:
 	cpu_rapl_device(cpudevice *parent, const char *classname = "cpu_core", const char *device_name = "cpu_core", class abstract_cpu *_cpu = NULL);
-	~cpu_rapl_device() { delete rapl; }
+	~cpu_rapl_device() { put_rapl_interface(rapl); }
 	virtual const char * device_name(void) {return "CPU core";};
 	bool device_present() { return device_valid;}
 	virtual double power_usage(struct result_bundle *result, struct parameter_bundle *bundle);
 	virtual void start_measurement(void);
 	virtual void end_measurement(void);
+	virtual double peak_power(void) { return peak; };
 
 };
 
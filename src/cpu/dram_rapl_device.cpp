@@ -34,36 +34,40 @@ dram_rapl_device::dram_rapl_device(cpudevice *parent, const char *classname, con
 	  device_valid(false)
 {
 	if (_cpu)
-		rapl = new c_rapl_interface(dev_name, cpu->get_first_cpu());
+		rapl = get_rapl_interface(dev_name, cpu->get_first_cpu());
 	else
-		rapl = new c_rapl_interface();
-	last_time = time(NULL);
+		rapl = get_rapl_interface();
+	last_time = 0;
+	last_energy = 0.0;
+	consumed_power = 0.0;
+	peak = 0.0;
 	if (rapl->dram_domain_present()) {
 		device_valid = true;
 		parent->add_child(this);
-		rapl->get_dram_energy_status(&last_energy);
+		last_energy = rapl->energy(RAPL_DRAM, &last_time);
 	}
 }
 
 void dram_rapl_device::start_measurement(void)
 {
-	last_time = time(NULL);
-
-	rapl->get_dram_energy_status(&last_energy);
+	last_energy = rapl->energy(RAPL_DRAM, &last_time);
+	rapl->take_peak_power(RAPL_DRAM);
 }
 
 void dram_rapl_device::end_measurement(void)
 {
-	time_t		curr_time = time(NULL);
+	uint64_t	curr_time;
 	double energy;
 
+	energy = rapl->energy(RAPL_DRAM, &curr_time);
+
+	/* energy() accounts for counter wraparound, time is in ns */
 	consumed_power = 0.0;
-	if ((curr_time - last_time) > 0) {
-		rapl->get_dram_energy_status(&energy);
-		consumed_power = (energy-last_energy)/(curr_time-last_time);
-		last_energy = energy;
-		last_time = curr_time;
-	}
+	if (curr_time > last_time)
+		consumed_power = (energy - last_energy) * 1000000000.0 / (curr_time - last_time);
+	last_energy = energy;
+	last_time = curr_time;
+	peak = rapl->take_peak_power(RAPL_DRAM);
 }
 
 double dram_rapl_device::power_usage(struct result_bundle *result, struct parameter_bundle *bundle)
@@ -157,6 +157,36 @@ static uint64_t get_msr(int cpu, uint64_t offset)
 	return msr;
 }
 
+#define MAX_MSR_BATCH 8
+
+struct msr_slot {
+	uint64_t	offset;
+	uint64_t	*value;
+};
+
+/* read a whole residency snapshot of one cpu through its cached msr handle */
+static void get_msr_batch(int cpu, const struct msr_slot *slots, int count)
+{
+	uint64_t offsets[MAX_MSR_BATCH];
+	uint64_t values[MAX_MSR_BATCH];
+	int i, ret;
+
+	for (i = 0; i < count; i++)
+		offsets[i] = slots[i].offset;
+
+	ret = read_msrs(cpu, offsets, values, count);
+	if (ret < count) {
+		reset_display();
+		fprintf(stderr, _("read_msr cpu%d 0x%llx : "), cpu,
+			(unsigned long long)offsets[ret < 0 ? 0 : ret]);
+		fprintf(stderr, "%s\n", strerror(errno));
+		exit(-2);
+	}
+
+	for (i = 0; i < count; i++)
+		*slots[i].value = values[i];
+}
+
 intel_util::intel_util()
 {
 	byt_ahci_support=0;
@@ -239,20 +269,24 @@ void nhm_core::measurement_start(void)
 {
 	ifstream file;
 	char filename[PATH_MAX];
+	struct msr_slot slots[MAX_MSR_BATCH];
+	int n;
 
 	/* the abstract function needs to be first since it clears all state */
 	abstract_cpu::measurement_start();
 
 	last_stamp = 0;
 
+	n = 0;
 	if (this->has_c1_res)
-		c1_before = get_msr(first_cpu, MSR_CORE_C1_RESIDENCY);
+		slots[n++] = { MSR_CORE_C1_RESIDENCY, &c1_before };
 	if (this->has_c3_res)
-		c3_before    = get_msr(first_cpu, MSR_CORE_C3_RESIDENCY);
-	c6_before    = get_msr(first_cpu, MSR_CORE_C6_RESIDENCY);
+		slots[n++] = { MSR_CORE_C3_RESIDENCY, &c3_before };
+	slots[n++] = { MSR_CORE_C6_RESIDENCY, &c6_before };
 	if (this->has_c7_res)
-		c7_before    = get_msr(first_cpu, MSR_CORE_C7_RESIDENCY);
-	tsc_before   = get_msr(first_cpu, MSR_TSC);
+		slots[n++] = { MSR_CORE_C7_RESIDENCY, &c7_before };
+	slots[n++] = { MSR_TSC, &tsc_before };
+	get_msr_batch(first_cpu, slots, n);
 
 	if (this->has_c1_res)
 		insert_cstate("core c1", "C1 (cc1)", 0, c1_before, 1);
@@ -288,15 +322,19 @@ void nhm_core::measurement_end(void)
 	unsigned int i;
 	uint64_t time_delta;
 	double ratio;
+	struct msr_slot slots[MAX_MSR_BATCH];
+	int n;
 
+	n = 0;
 	if (this->has_c1_res)
-		c1_after = get_msr(first_cpu, MSR_CORE_C1_RESIDENCY);
+		slots[n++] = { MSR_CORE_C1_RESIDENCY, &c1_after };
 	if (this->has_c3_res)
-		c3_after    = get_msr(first_cpu, MSR_CORE_C3_RESIDENCY);
-	c6_after    = get_msr(first_cpu, MSR_CORE_C6_RESIDENCY);
+		slots[n++] = { MSR_CORE_C3_RESIDENCY, &c3_after };
+	slots[n++] = { MSR_CORE_C6_RESIDENCY, &c6_after };
 	if (this->has_c7_res)
-		c7_after    = get_msr(first_cpu, MSR_CORE_C7_RESIDENCY);
-	tsc_after   = get_msr(first_cpu, MSR_TSC);
+		slots[n++] = { MSR_CORE_C7_RESIDENCY, &c7_after };
+	slots[n++] = { MSR_TSC, &tsc_after };
+	get_msr_batch(first_cpu, slots, n);
 
 	if (this->has_c1_res)
 		finalize_cstate("core c1", 0, c1_after, 1);
@@ -310,11 +348,10 @@ void nhm_core::measurement_end(void)
 
 	time_factor = 1000000.0 * (stamp_after.tv_sec - stamp_before.tv_sec) + stamp_after.tv_usec - stamp_before.tv_usec;
 
+	children_measurement_end();
 	for (i = 0; i < children.size(); i++)
-		if (children[i]) {
-			children[i]->measurement_end();
+		if (children[i])
 			children[i]->wiggle();
-		}
 
 	time_delta = 1000000 * (stamp_after.tv_sec - stamp_before.tv_sec) + stamp_after.tv_usec - stamp_before.tv_usec;
 
@@ -511,31 +548,35 @@ char * nhm_package::fill_pstate_line(int line_nr, char *buffer)
 
 void nhm_package::measurement_start(void)
 {
+	struct msr_slot slots[MAX_MSR_BATCH];
+	int n;
+
 	abstract_cpu::measurement_start();
 
 	last_stamp = 0;
 
+	n = 0;
 	if (this->has_c2c6_res)
-		c2_before    = get_msr(number, MSR_PKG_C2_RESIDENCY);
-
+		slots[n++] = { MSR_PKG_C2_RESIDENCY, &c2_before };
 	if (this->has_c3_res)
-		c3_before    = get_msr(number, MSR_PKG_C3_RESIDENCY);
+		slots[n++] = { MSR_PKG_C3_RESIDENCY, &c3_before };
 
 	/*
 	 * Hack for Braswell where C7 MSR is actually BSW C6
 	 */
 	if (this->has_c6c_res)
-		c6_before    = get_msr(number, MSR_PKG_C7_RESIDENCY);
+		slots[n++] = { MSR_PKG_C7_RESIDENCY, &c6_before };
 	else
-		c6_before    = get_msr(number, MSR_PKG_C6_RESIDENCY);
+		slots[n++] = { MSR_PKG_C6_RESIDENCY, &c6_before };
 
 	if (this->has_c7_res)
-		c7_before    = get_msr(number, MSR_PKG_C7_RESIDENCY);
+		slots[n++] = { MSR_PKG_C7_RESIDENCY, &c7_before };
 	if (this->has_c8c9c10_res) {
-		c8_before    = get_msr(number, MSR_PKG_C8_RESIDENCY);
-		c9_before    = get_msr(number, MSR_PKG_C9_RESIDENCY);
-		c10_before    = get_msr(number, MSR_PKG_C10_RESIDENCY);
+		slots[n++] = { MSR_PKG_C8_RESIDENCY, &c8_before };
+		slots[n++] = { MSR_PKG_C9_RESIDENCY, &c9_before };
+		slots[n++] = { MSR_PKG_C10_RESIDENCY, &c10_before };
 	}
+	get_msr_batch(number, slots, n);
 	tsc_before   = get_msr(first_cpu, MSR_TSC);
 
 	if (this->has_c2c6_res)
@@ -558,30 +599,36 @@ void nhm_package::measurement_end(void)
 	uint64_t time_delta;
 	double ratio;
 	unsigned int i, j;
+	struct msr_slot slots[MAX_MSR_BATCH];
+	int n;
 
 	for (i = 0; i < children.size(); i++)
 		if (children[i])
 			children[i]->wiggle();
 
 
+	n = 0;
 	if (this->has_c2c6_res)
-		c2_after    = get_msr(number, MSR_PKG_C2_RESIDENCY);
-
+		slots[n++] = { MSR_PKG_C2_RESIDENCY, &c2_after };
 	if (this->has_c3_res)
-		c3_after    = get_msr(number, MSR_PKG_C3_RESIDENCY);
+		slots[n++] = { MSR_PKG_C3_RESIDENCY, &c3_after };
 
+	/*
+	 * Hack for Braswell where C7 MSR is actually BSW C6
+	 */
 	if (this->has_c6c_res)
-		c6_after    = get_msr(number, MSR_PKG_C7_RESIDENCY);
+		slots[n++] = { MSR_PKG_C7_RESIDENCY, &c6_after };
 	else
-		c6_after    = get_msr(number, MSR_PKG_C6_RESIDENCY);
+		slots[n++] = { MSR_PKG_C6_RESIDENCY, &c6_after };
 
 	if (this->has_c7_res)
-		c7_after    = get_msr(number, MSR_PKG_C7_RESIDENCY);
-	if (has_c8c9c10_res) {
-		c8_after = get_msr(number, MSR_PKG_C8_RESIDENCY);
-		c9_after = get_msr(number, MSR_PKG_C9_RESIDENCY);
-		c10_after = get_msr(number, MSR_PKG_C10_RESIDENCY);
+		slots[n++] = { MSR_PKG_C7_RESIDENCY, &c7_after };
+	if (this->has_c8c9c10_res) {
+		slots[n++] = { MSR_PKG_C8_RESIDENCY, &c8_after };
+		slots[n++] = { MSR_PKG_C9_RESIDENCY, &c9_after };
+		slots[n++] = { MSR_PKG_C10_RESIDENCY, &c10_after };
 	}
+	get_msr_batch(number, slots, n);
 	tsc_after   = get_msr(first_cpu, MSR_TSC);
 
 	gettimeofday(&stamp_after, NULL);
@@ -603,9 +650,7 @@ void nhm_package::measurement_end(void)
 		finalize_cstate("pkg c10", 0, c10_after, 1);
 	}
 
-	for (i = 0; i < children.size(); i++)
-		if (children[i])
-			children[i]->measurement_end();
+	children_measurement_end();
 
 	time_delta = 1000000 * (stamp_after.tv_sec - stamp_before.tv_sec) + stamp_after.tv_usec - stamp_before.tv_usec;
 
@@ -649,9 +694,13 @@ void nhm_cpu::measurement_start(void)
 
 	last_stamp = 0;
 
-	aperf_before = get_msr(number, MSR_APERF);
-	mperf_before = get_msr(number, MSR_MPERF);
-	tsc_before   = get_msr(number, MSR_TSC);
+	struct msr_slot slots[] = {
+		{ MSR_APERF, &aperf_before },
+		{ MSR_MPERF, &mperf_before },
+		{ MSR_TSC, &tsc_before },
+	};
+
+	get_msr_batch(number, slots, 3);
 
 	insert_cstate("active", _("C0 active"), 0, aperf_before, 1);
 
@@ -679,9 +728,13 @@ void nhm_cpu::measurement_end(void)
 	double ratio;
 	unsigned int i;
 
-	aperf_after = get_msr(number, MSR_APERF);
-	mperf_after = get_msr(number, MSR_MPERF);
-	tsc_after   = get_msr(number, MSR_TSC);
+	struct msr_slot slots[] = {
+		{ MSR_APERF, &aperf_after },
+		{ MSR_MPERF, &mperf_after },
+		{ MSR_TSC, &tsc_after },
+	};
+
+	get_msr_batch(number, slots, 3);
 
 
 
@@ -29,6 +29,10 @@
 #include <math.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <time.h>
+#include <vector>
+#include <map>
+#include <string.h>
 #include "lib.h"
 #include "rapl_interface.h"
 
@@ -70,8 +74,127 @@
 #define PP0_DOMAIN_PRESENT	0x04
 #define PP1_DOMAIN_PRESENT	0x08
 
+int rapl_sample_rate = 10;
+
+/* a fresher reading than this is reused instead of reading the counters again */
+#define RAPL_MIN_READ_NS	1000000ULL
+
+/*
+ * All interfaces with at least one energy domain are sampled from a single
+ * background thread, so the energy counters are read often enough that a
+ * wraparound is never missed and short power bursts show up as peaks.
+ * There is one interface per package, shared by all RAPL devices on it,
+ * so every domain is read once per tick.
+ */
+static vector<c_rapl_interface *> rapl_sources;
+static pthread_mutex_t rapl_sources_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t rapl_thread;
+static bool rapl_thread_running;
+static volatile int rapl_thread_stop;
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *rapl_sampler_thread(void *arg)
+{
+	struct timespec interval;
+	unsigned int i;
+
+	interval.tv_sec = 0;
+	interval.tv_nsec = 1000000000L / rapl_sample_rate;
+	if (rapl_sample_rate == 1) {
+		interval.tv_sec = 1;
+		interval.tv_nsec = 0;
+	}
+
+	while (!rapl_thread_stop) {
+		pthread_mutex_lock(&rapl_sources_lock);
+		for (i = 0; i < rapl_sources.size(); i++)
+			rapl_sources[i]->sample();
+		pthread_mutex_unlock(&rapl_sources_lock);
+		nanosleep(&interval, NULL);
+	}
+
+	return NULL;
+}
+
+static void register_rapl_source(c_rapl_interface *rapl)
+{
+	pthread_mutex_lock(&rapl_sources_lock);
+	rapl_sources.push_back(rapl);
+	if (!rapl_thread_running && rapl_sample_rate > 0) {
+		rapl_thread_stop = 0;
+		if (pthread_create(&rapl_thread, NULL, rapl_sampler_thread, NULL) == 0)
+			rapl_thread_running = true;
+	}
+	pthread_mutex_unlock(&rapl_sources_lock);
+}
+
+static void unregister_rapl_source(c_rapl_interface *rapl)
+{
+	unsigned int i;
+	bool stop;
+
+	pthread_mutex_lock(&rapl_sources_lock);
+	for (i = 0; i < rapl_sources.size(); i++)
+		if (rapl_sources[i] == rapl) {
+			rapl_sources.erase(rapl_sources.begin() + i);
+			break;
+		}
+	stop = rapl_sources.empty() && rapl_thread_running;
+	if (stop)
+		rapl_thread_stop = 1;
+	pthread_mutex_unlock(&rapl_sources_lock);
+
+	if (stop) {
+		pthread_join(rapl_thread, NULL);
+		rapl_thread_running = false;
+	}
+}
+
+struct shared_rapl {
+	c_rapl_interface	*rapl;
+	int			users;
+};
+
+static map<string, struct shared_rapl> shared_interfaces;
+
+c_rapl_interface *get_rapl_interface(const char *dev_name, int cpu)
+{
+	struct shared_rapl *shared;
+	char key[128];
+
+	snprintf(key, sizeof(key), "%s/%d", dev_name ? dev_name : "", cpu);
+	shared = &shared_interfaces[key];
+	if (!shared->rapl)
+		shared->rapl = new c_rapl_interface(dev_name, cpu);
+	shared->users++;
+	return shared->rapl;
+}
+
+void put_rapl_interface(c_rapl_interface *rapl)
+{
+	map<string, struct shared_rapl>::iterator it;
+
+	for (it = shared_interfaces.begin(); it != shared_interfaces.end(); ++it) {
+		if (it->second.rapl != rapl)
+			continue;
+		if (--it->second.users == 0) {
+			delete rapl;
+			shared_interfaces.erase(it);
+		}
+		return;
+	}
+}
+
 c_rapl_interface::c_rapl_interface(const char *dev_name, int cpu) :
 	powercap_sysfs_present(false),
+	powercap_pkg_path(),
 	powercap_core_path(),
 	powercap_uncore_path(),
 	powercap_dram_path(),
@@ -91,6 +214,8 @@ c_rapl_interface::c_rapl_interface(const char *dev_name, int cpu) :
 	RAPL_INFO_PRINT("RAPL device for cpu %d\n", cpu);
 
 	rapl_domains = 0;
+	sampling = false;
+	pthread_mutex_init(&sample_lock, NULL);
 
 	if (dev_name) {
 		string base_path = "/sys/class/powercap/intel-rapl/";
@@ -112,6 +237,7 @@ c_rapl_interface::c_rapl_interface(const char *dev_name, int cpu) :
 	}
 
 	if (powercap_sysfs_present) {
+		powercap_pkg_path = package_path;
 		if ((dir = opendir(package_path.c_str())) != NULL) {
 			while ((entry = readdir(dir)) != NULL) {
 				string path = package_path + entry->d_name;
@@ -135,6 +261,7 @@ c_rapl_interface::c_rapl_interface(const char *dev_name, int cpu) :
 		}
 
 		RAPL_INFO_PRINT("RAPL Using PowerCap Sysfs : Domain Mask %x\n", rapl_domains);
+		init_sampling();
 		return;
 	}
 
@@ -182,6 +309,40 @@ c_rapl_interface::c_rapl_interface(const char *dev_name, int cpu) :
 	time_units = get_time_unit();
 
 	RAPL_DBG_PRINT("RAPL Domain mask: %x\n", rapl_domains);
+
+	init_sampling();
+}
+
+c_rapl_interface::~c_rapl_interface()
+{
+	if (sampling)
+		unregister_rapl_source(this);
+	pthread_mutex_destroy(&sample_lock);
+}
+
+void c_rapl_interface::init_sampling(void)
+{
+	int i;
+
+	sample_time = monotonic_ns();
+	tick_time = 0;
+	for (i = 0; i < RAPL_DOMAINS; i++) {
+		joules[i] = 0.0;
+		tick_joules[i] = 0.0;
+		peak[i] = 0.0;
+		last_raw[i] = 0.0;
+		energy_range[i] = 0.0;
+		if (!domain_present(i))
+			continue;
+		energy_range[i] = read_energy_range(i);
+		get_energy_status(i, &last_raw[i]);
+	}
+
+	if (!rapl_domains)
+		return;
+
+	sampling = true;
+	register_rapl_source(this);
 }
 
 bool c_rapl_interface::pkg_domain_present()
@@ -220,6 +381,22 @@ bool c_rapl_interface::pp1_domain_present()
 	return false;
 }
 
+bool c_rapl_interface::domain_present(int domain)
+{
+	switch (domain) {
+	case RAPL_PKG:
+		return pkg_domain_present();
+	case RAPL_PP0:
+		return pp0_domain_present();
+	case RAPL_PP1:
+		return pp1_domain_present();
+	case RAPL_DRAM:
+		return dram_domain_present();
+	}
+
+	return false;
+}
+
 int c_rapl_interface::read_msr(int cpu, unsigned int idx, uint64_t *val)
 {
 	return ::read_msr(cpu, idx, val);
@@ -290,6 +467,16 @@ int c_rapl_interface::get_pkg_energy_status(double *status)
 		return -1;
 	}
 
+	if (powercap_sysfs_present) {
+		string str = read_sysfs_string(powercap_pkg_path + "energy_uj");
+		if (str.length() > 0) {
+			*status =  atof(str.c_str()) / 1000000; // uj to Js
+			return 0;
+		}
+
+		return -EINVAL;
+	}
+
 	ret = read_msr(first_cpu, MSR_PKG_ENERY_STATUS, &value);
 	if(ret < 0)
 	{
@@ -628,6 +815,141 @@ int c_rapl_interface::get_pp1_power_policy(unsigned int *pp1_power_policy)
 	return ret;
 }
 
+int c_rapl_interface::get_energy_status(int domain, double *status)
+{
+	switch (domain) {
+	case RAPL_PKG:
+		return get_pkg_energy_status(status);
+	case RAPL_PP0:
+		return get_pp0_energy_status(status);
+	case RAPL_PP1:
+		return get_pp1_energy_status(status);
+	case RAPL_DRAM:
+		return get_dram_energy_status(status);
+	}
+
+	return -EINVAL;
+}
+
+/* energy in joules at which the domain's counter wraps back to zero */
+double c_rapl_interface::read_energy_range(int domain)
+{
+	string path;
+	string str;
+
+	if (!powercap_sysfs_present) {
+		if (energy_status_units <= 0)
+			return 0.0;
+		return 4294967296.0 * energy_status_units;
+	}
+
+	switch (domain) {
+	case RAPL_PKG:
+		path = powercap_pkg_path;
+		break;
+	case RAPL_PP0:
+		path = powercap_core_path;
+		break;
+	case RAPL_PP1:
+		path = powercap_uncore_path;
+		break;
+	case RAPL_DRAM:
+		path = powercap_dram_path;
+		break;
+	}
+
+	str = read_sysfs_string(path + "max_energy_range_uj");
+	if (str.length() > 0)
+		return atof(str.c_str()) / 1000000;
+	return 0.0;
+}
+
+/* called with sample_lock held */
+void c_rapl_interface::take_sample(void)
+{
+	double raw, delta;
+	int i;
+
+	sample_time = monotonic_ns();
+
+	for (i = 0; i < RAPL_DOMAINS; i++) {
+		if (!domain_present(i) || get_energy_status(i, &raw) < 0)
+			continue;
+		delta = raw - last_raw[i];
+		if (delta < 0 && energy_range[i] > 0)
+			delta += energy_range[i];
+		if (delta > 0)
+			joules[i] += delta;
+		last_raw[i] = raw;
+	}
+}
+
+/*
+ * One sampler tick. Peaks are only taken between ticks, so they are
+ * averaged over the sampling interval and not over the arbitrarily short
+ * gaps between energy() calls.
+ */
+void c_rapl_interface::sample(void)
+{
+	double watts;
+	int i;
+
+	if (!sampling)
+		return;
+
+	pthread_mutex_lock(&sample_lock);
+	take_sample();
+	if (tick_time && sample_time > tick_time) {
+		for (i = 0; i < RAPL_DOMAINS; i++) {
+			watts = (joules[i] - tick_joules[i]) * 1000000000.0 / (sample_time - tick_time);
+			if (watts > peak[i])
+				peak[i] = watts;
+		}
+	}
+	tick_time = sample_time;
+	memcpy(tick_joules, joules, sizeof(tick_joules));
+	pthread_mutex_unlock(&sample_lock);
+}
+
+/*
+ * Energy consumed by @domain since the interface was created, in joules,
+ * with the monotonic time (ns) of the reading in @time.
+ */
+double c_rapl_interface::energy(int domain, uint64_t *time)
+{
+	double ret;
+
+	if (!sampling) {
+		*time = monotonic_ns();
+		return 0.0;
+	}
+
+	pthread_mutex_lock(&sample_lock);
+	if (monotonic_ns() - sample_time >= RAPL_MIN_READ_NS)
+		take_sample();
+	*time = sample_time;
+	ret = joules[domain];
+	pthread_mutex_unlock(&sample_lock);
+
+	return ret;
+}
+
+/* highest power of @domain between two sampler ticks since the last call, in W */
+double c_rapl_interface::take_peak_power(int domain)
+{
+	double ret;
+
+	if (!sampling)
+		return 0.0;
+
+	pthread_mutex_lock(&sample_lock);
+	ret = peak[domain];
+	peak[domain] = 0.0;
+	pthread_mutex_unlock(&sample_lock);
+
+	return ret;
+}
+
 void c_rapl_interface::rapl_measure_energy()
 {
 #ifdef RAPL_TEST_MODE
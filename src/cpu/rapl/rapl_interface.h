@@ -24,11 +24,24 @@
 #ifndef RAPL_INTERFACE_H
 #define RAPL_INTERFACE_H
 
+#include <stdint.h>
+#include <pthread.h>
+
+#define RAPL_PKG	0
+#define RAPL_PP0	1
+#define RAPL_PP1	2
+#define RAPL_DRAM	3
+#define RAPL_DOMAINS	4
+
+/* background sampling rate in Hz, 0 samples only at measurement boundaries */
+extern int rapl_sample_rate;
+
 class c_rapl_interface
 {
 private:
 	static const int def_sampling_interval = 1; //In seconds
 	bool powercap_sysfs_present;
+	string powercap_pkg_path;
 	string powercap_core_path;
 	string powercap_uncore_path;
 	string powercap_dram_path;
@@ -43,6 +56,21 @@ private:
 	int read_msr(int cpu, unsigned int idx, uint64_t *val);
 	int write_msr(int cpu, unsigned int idx, uint64_t val);
 
+	/* energy is accumulated since the interface was created */
+	pthread_mutex_t	sample_lock;
+	bool		sampling;
+	double		energy_range[RAPL_DOMAINS];
+	double		last_raw[RAPL_DOMAINS];
+	double		joules[RAPL_DOMAINS];
+	uint64_t	sample_time;		/* CLOCK_MONOTONIC, ns */
+	uint64_t	tick_time;		/* last sampler tick */
+	double		tick_joules[RAPL_DOMAINS];
+	double		peak[RAPL_DOMAINS];	/* W */
+
+	void init_sampling(void);
+	double read_energy_range(int domain);
+	void take_sample(void);
+
 protected:
 	int measurment_interval;
 	double last_pkg_energy_status;
@@ -52,6 +80,7 @@ protected:
 
 public:
 	c_rapl_interface(const char *dev_name = "package-0", int cpu = 0);
+	~c_rapl_interface();
 
 	int get_rapl_power_unit(uint64_t *value);
 	double get_power_unit();
@@ -84,8 +113,18 @@ public:
 	bool dram_domain_present();
 	bool pp0_domain_present();
 	bool pp1_domain_present();
+	bool domain_present(int domain);
+
+	int get_energy_status(int domain, double *status);
+	void sample(void);
+	double energy(int domain, uint64_t *time);
+	double take_peak_power(int domain);
 
 	void rapl_measure_energy();
 };
 
+/* one interface per package, shared by the RAPL devices on it */
+extern c_rapl_interface *get_rapl_interface(const char *dev_name = "package-0", int cpu = 0);
+extern void put_rapl_interface(c_rapl_interface *rapl);
+
 #endif
@@ -131,6 +131,15 @@ ahci::ahci(char *_name, char *path): device()
 
 	register_sysfs_path(sysfs_path);
 
+	snprintf(buffer, sizeof(buffer), "%s/ahci_alpm_active", sysfs_path);
+	alpm_active.set_path(buffer);
+	snprintf(buffer, sizeof(buffer), "%s/ahci_alpm_partial", sysfs_path);
+	alpm_partial.set_path(buffer);
+	snprintf(buffer, sizeof(buffer), "%s/ahci_alpm_slumber", sysfs_path);
+	alpm_slumber.set_path(buffer);
+	snprintf(buffer, sizeof(buffer), "%s/ahci_alpm_devslp", sysfs_path);
+	alpm_devslp.set_path(buffer);
+
 	snprintf(devname, sizeof(devname), "ahci:%s", _name);
 	pt_strcpy(name, devname);
 	active_index = get_param_index("ahci-link-power-active");
@@ -158,79 +167,23 @@ ahci::ahci(char *_name, char *path): device()
 
 void ahci::start_measurement(void)
 {
-	char filename[PATH_MAX];
-	ifstream file;
-
-	snprintf(filename, sizeof(filename), "%s/ahci_alpm_active", sysfs_path);
-	try {
-		file.open(filename, ios::in);
-		if (file) {
-			file >> start_active;
-		}
-		file.close();
-		snprintf(filename, sizeof(filename), "%s/ahci_alpm_partial", sysfs_path);
-		file.open(filename, ios::in);
-
-		if (file) {
-			file >> start_partial;
-		}
-		file.close();
-		snprintf(filename, sizeof(filename), "%s/ahci_alpm_slumber", sysfs_path);
-		file.open(filename, ios::in);
-		if (file) {
-			file >> start_slumber;
-		}
-		file.close();
-		snprintf(filename, sizeof(filename), "%s/ahci_alpm_devslp", sysfs_path);
-		file.open(filename, ios::in);
-		if (file) {
-			file >> start_devslp;
-		}
-		file.close();
-	}
-	catch (std::ios_base::failure &c) {
-		fprintf(stderr, "%s\n", c.what());
-	}
-
+	alpm_active.read_u64(&start_active);
+	alpm_partial.read_u64(&start_partial);
+	alpm_slumber.read_u64(&start_slumber);
+	alpm_devslp.read_u64(&start_devslp);
 }
 
 void ahci::end_measurement(void)
 {
-	char filename[PATH_MAX];
 	char powername[4096];
-	ifstream file;
 	double p;
 	double total;
 
-	try {
-		snprintf(filename, sizeof(filename), "%s/ahci_alpm_active", sysfs_path);
-		file.open(filename, ios::in);
-		if (file) {
-			file >> end_active;
-		}
-		file.close();
-		snprintf(filename, sizeof(filename), "%s/ahci_alpm_partial", sysfs_path);
-		file.open(filename, ios::in);
-		if (file) {
-			file >> end_partial;
-		}
-		file.close();
-		snprintf(filename, sizeof(filename), "%s/ahci_alpm_slumber", sysfs_path);
-		file.open(filename, ios::in);
-		if (file) {
-			file >> end_slumber;
-		}
-		file.close();
-		snprintf(filename, sizeof(filename), "%s/ahci_alpm_devslp", sysfs_path);
-		file.open(filename, ios::in);
-		if (file) {
-			file >> end_devslp;
-		}
-		file.close();
-	}
-	catch (std::ios_base::failure &c) {
-		fprintf(stderr, "%s\n", c.what());
-	}
+	alpm_active.read_u64(&end_active);
+	alpm_partial.read_u64(&end_partial);
+	alpm_slumber.read_u64(&end_slumber);
+	alpm_devslp.read_u64(&end_devslp);
+
 	if (end_active < start_active)
 		end_active = start_active;
 	if (end_partial < start_partial)
@@ -30,6 +30,7 @@
 #include <limits.h>
 #include "device.h"
 #include "../parameters/parameters.h"
+#include "../lib.h"
 #include <stdint.h>
 
 class ahci: public device {
@@ -37,6 +38,10 @@ class ahci: public device {
 	uint64_t start_partial, end_partial;
 	uint64_t start_slumber, end_slumber;
 	uint64_t start_devslp, end_devslp;
+	sysfs_attr alpm_active;
+	sysfs_attr alpm_partial;
+	sysfs_attr alpm_slumber;
+	sysfs_attr alpm_devslp;
 	char sysfs_path[PATH_MAX];
 	char name[4096];
 	int partial_rindex;
@@ -25,6 +25,7 @@
 
 #include "device.h"
 #include <vector>
+#include <string>
 #include <algorithm>
 #include <stdio.h>
 #include <limits.h>
@@ -52,6 +53,7 @@ using namespace std;
 #include "../report/report-data-html.h"
 #include "../measurement/measurement.h"
 #include "../devlist.h"
+#include "../perf/perf_record.h"
 #include <unistd.h>
 
 device::device(void)
@@ -102,18 +104,30 @@ double	device::utilization(void)
 vector<class device *> all_devices;
 
 
+/*
+ * Snapshots are mostly blocking sysfs reads and ioctls on unrelated
+ * devices; take them side by side so the window edges stay tight.
+ */
+static void device_start_measurement(unsigned int index, void *arg)
+{
+	all_devices[index]->start_measurement();
+}
+
+static void device_end_measurement(unsigned int index, void *arg)
+{
+	all_devices[index]->end_measurement();
+}
+
 void devices_start_measurement(void)
 {
-	unsigned int i;
-	for (i = 0; i < all_devices.size(); i++)
-		all_devices[i]->start_measurement();
+	parallel_for(all_devices.size(), device_start_measurement, NULL);
 }
 
 void devices_end_measurement(void)
 {
 	unsigned int i;
-	for (i = 0; i < all_devices.size(); i++)
-		all_devices[i]->end_measurement();
+
+	parallel_for(all_devices.size(), device_end_measurement, NULL);
 
 	clear_devpower();
 
@@ -143,15 +157,36 @@ static bool power_device_sort(class device * i, class device * j)
 }
 
 
+/* devices with a sampled short term peak get a column for it */
+static bool devices_have_peak(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < all_devices.size(); i++)
+		if (all_devices[i]->peak_power() > 0.0001)
+			return true;
+	return false;
+}
+
+static void format_peak(class device *dev, char *buffer, unsigned int len)
+{
+	if (dev->peak_power() > 0.0001)
+		format_watts(dev->peak_power(), buffer, len);
+	else
+		sprintf(buffer, "%*s", len, "");
+}
+
 void report_devices(void)
 {
 	WINDOW *win;
 	unsigned int i;
 	int show_power;
+	bool show_peak;
 	double pw;
 
 	char util[128];
 	char power[128];
+	char peak[128];
 
 	win = get_ncurses_win("Device stats");
         if (!win)
@@ -185,10 +220,14 @@ void report_devices(void)
 	wprintw(win, "%s\n","Usage - 전력 사용 비율 / Device name - 기기 이름");
 	if (pw > 0.0001 || show_power)
 		wprintw(win, "\n");
+	show_peak = devices_have_peak();
 	if (show_power)
-		wprintw(win, _("Power est.    Usage     Device name\n"));
+		wprintw(win, "%s", _("Power est.  "));
 	else
-		wprintw(win, _("              Usage     Device name\n"));
+		wprintw(win, "            ");
+	if (show_peak)
+		wprintw(win, "%s", _("Peak        "));
+	wprintw(win, _("  Usage     Device name\n"));
 
 	for (i = 0; i < all_devices.size(); i++) {
 		double P;
@@ -211,8 +250,12 @@ void report_devices(void)
 			strcpy(power, "           ");
 
 
-		wprintw(win, "%s %s %s\n",
-			power,
+		wprintw(win, "%s ", power);
+		if (show_peak) {
+			format_peak(all_devices[i], peak, 11);
+			wprintw(win, "%s ", peak);
+		}
+		wprintw(win, "%s %s\n",
 			util,
 			all_devices[i]->human_name()
 			);
@@ -222,10 +265,11 @@ void report_devices(void)
 void show_report_devices(void)
 {
 	unsigned int i;
-	int show_power, cols, rows, idx;
+	int show_power, show_peak, cols, rows, idx;
 	double pw;
 
 	show_power = global_power_valid();
+	show_peak = devices_have_peak();
 	sort(all_devices.begin(), all_devices.end(), power_device_sort);
 
 	/* div attr css_class and css_id */
@@ -236,7 +280,9 @@ void show_report_devices(void)
         table_attributes std_table_css;
 	cols=2;
         if (show_power)
-                cols=3;
+                cols++;
+	if (show_peak)
+		cols++;
 
 	idx = cols;
  	rows= all_devices.size() + 1;
@@ -280,6 +326,8 @@ void show_report_devices(void)
 	device_data[1]= __("Device Name");
 	if (show_power)
 		device_data[2]= __("PW Estimate");
+	if (show_peak)
+		device_data[cols - 1]= __("Peak Power");
 
 	for (i = 0; i < all_devices.size(); i++) {
 		double P;
@@ -314,6 +362,11 @@ void show_report_devices(void)
 			device_data[idx]= string(power);
 			idx+=1;
 		}
+		if (show_peak) {
+			format_peak(all_devices[i], power, 11);
+			device_data[idx]= string(power);
+			idx+=1;
+		}
 	}
 	/* Report Output */
 	report.add_title(&title_attr, __("Device Power Report"));
@@ -337,9 +390,120 @@ void create_all_devices(void)
 }
 
 
+/* a device of the recording machine, as it was at the end of a window */
+class recorded_device: public device {
+public:
+	string	class_str, device_str, human_str, units_str;
+	bool	has_units, shown;
+	int	valid, prio;
+	double	util, power, peak;
+
+	virtual double	utilization(void) { return util; };
+	virtual const char * util_units(void) { return has_units ? units_str.c_str() : NULL; };
+
+	virtual const char * class_name(void) { return class_str.c_str(); };
+	virtual const char * device_name(void) { return device_str.c_str(); };
+	virtual const char * human_name(void) { return human_str.c_str(); };
+
+	virtual double power_usage(struct result_bundle *results, struct parameter_bundle *bundle) { return power; };
+	virtual double peak_power(void) { return peak; };
+	virtual bool show_in_list(void) { return shown && !hide; };
+	virtual int power_valid(void) { return valid; };
+	virtual int grouping_prio(void) { return prio; };
+};
+
+/*
+ * Replayed devices live for the whole run, also while absent from a window:
+ * the devpower list keeps pointers to them.
+ */
+static vector<class recorded_device *> recorded_devices;
+
+/* saved after the processes were charged, which hides the charged devices */
+void save_devices(class trace_snapshot &snapshot)
+{
+	class device *dev;
+	unsigned int i;
+	bool hide;
+
+	snapshot.put_u32(all_devices.size());
+	for (i = 0; i < all_devices.size(); i++) {
+		dev = all_devices[i];
+		snapshot.put_string(dev->class_name());
+		snapshot.put_string(dev->device_name());
+		snapshot.put_string(dev->human_name());
+		snapshot.put_u32(dev->util_units() != NULL);
+		snapshot.put_string(dev->util_units() ? dev->util_units() : "");
+		snapshot.put_double(dev->utilization());
+		snapshot.put_double(dev->power_usage(&all_results, &all_parameters));
+		snapshot.put_u32(dev->power_valid());
+		snapshot.put_double(dev->peak_power());
+		hide = dev->hide;
+		dev->hide = false;
+		snapshot.put_u32(dev->show_in_list());
+		dev->hide = hide;
+		snapshot.put_u32(dev->grouping_prio());
+		snapshot.put_string(dev->real_path);
+	}
+}
+
+/* all_devices becomes the recorded devices of the window, in recorded order */
+void load_devices(class trace_snapshot &snapshot)
+{
+	class recorded_device *dev;
+	string class_str, device_str;
+	unsigned int i, j, count;
+
+	all_devices.clear();
+
+	count = snapshot.get_u32();
+	for (i = 0; i < count && !snapshot.failed(); i++) {
+		class_str = snapshot.get_string();
+		device_str = snapshot.get_string();
+
+		dev = NULL;
+		for (j = 0; j < recorded_devices.size(); j++)
+			if (recorded_devices[j]->class_str == class_str &&
+			    recorded_devices[j]->device_str == device_str) {
+				dev = recorded_devices[j];
+				break;
+			}
+		if (!dev) {
+			dev = new class recorded_device;
+			dev->class_str = class_str;
+			dev->device_str = device_str;
+			recorded_devices.push_back(dev);
+		}
+
+		dev->human_str = snapshot.get_string();
+		dev->has_units = snapshot.get_u32();
+		dev->units_str = snapshot.get_string();
+		dev->util = snapshot.get_double();
+		dev->power = snapshot.get_double();
+		dev->valid = snapshot.get_u32();
+		dev->peak = snapshot.get_double();
+		dev->shown = snapshot.get_u32();
+		dev->prio = snapshot.get_u32();
+		snapshot.get_string(dev->real_path, sizeof(dev->real_path));
+		dev->hide = false;
+
+		if (!snapshot.failed())
+			all_devices.push_back(dev);
+	}
+}
+
 void clear_all_devices(void)
 {
 	unsigned int i;
+
+	/* all_devices only holds some of them */
+	if (!recorded_devices.empty()) {
+		for (i = 0; i < recorded_devices.size(); i++)
+			delete recorded_devices[i];
+		recorded_devices.clear();
+		all_devices.clear();
+		return;
+	}
+
 	for (i = 0; i < all_devices.size(); i++) {
 		delete all_devices[i];
 	}
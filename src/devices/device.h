@@ -59,6 +59,7 @@ public:
 	virtual const char * human_name(void) { return device_name(); };
 
 	virtual double power_usage(struct result_bundle *results, struct parameter_bundle *bundle) { return 0.0; };
+	virtual double peak_power(void) { return 0.0; }; /* measured short term peak in W, 0 if not measured */
 
 	virtual bool show_in_list(void) {return !hide;};
 
@@ -82,4 +83,8 @@ extern void report_devices(void);
 extern void create_all_devices(void);
 extern void clear_all_devices(void);
 
+class trace_snapshot;
+extern void save_devices(class trace_snapshot &snapshot);
+extern void load_devices(class trace_snapshot &snapshot);
+
 #endif
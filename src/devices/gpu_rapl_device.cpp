@@ -32,38 +32,43 @@ gpu_rapl_device::gpu_rapl_device(i915gpu *parent)
 	: i915gpu(),
 	  device_valid(false)
 {
-	last_time = time(NULL);
-	if (rapl.pp1_domain_present()) {
+	rapl = get_rapl_interface();
+	last_time = 0;
+	last_energy = 0.0;
+	consumed_power = 0.0;
+	peak = 0.0;
+	if (rapl->pp1_domain_present()) {
 		device_valid = true;
 		parent->add_child(this);
-		rapl.get_pp1_energy_status(&last_energy);
+		last_energy = rapl->energy(RAPL_PP1, &last_time);
 	}
 }
 
 void gpu_rapl_device::start_measurement(void)
 {
-	last_time = time(NULL);
-
-	rapl.get_pp1_energy_status(&last_energy);
+	last_energy = rapl->energy(RAPL_PP1, &last_time);
+	rapl->take_peak_power(RAPL_PP1);
 }
 
 void gpu_rapl_device::end_measurement(void)
 {
-	time_t		curr_time = time(NULL);
+	uint64_t	curr_time;
 	double energy;
 
+	energy = rapl->energy(RAPL_PP1, &curr_time);
+
+	/* energy() accounts for counter wraparound, time is in ns */
 	consumed_power = 0.0;
-	if ((curr_time - last_time) > 0) {
-		rapl.get_pp1_energy_status(&energy);
-		consumed_power = (energy-last_energy)/(curr_time-last_time);
-		last_energy = energy;
-		last_time = curr_time;
-	}
+	if (curr_time > last_time)
+		consumed_power = (energy - last_energy) * 1000000000.0 / (curr_time - last_time);
+	last_energy = energy;
+	last_time = curr_time;
+	peak = rapl->take_peak_power(RAPL_PP1);
 }
 
 double gpu_rapl_device::power_usage(struct result_bundle *result, struct parameter_bundle *bundle)
 {
-	if (rapl.pp1_domain_present())
+	if (rapl->pp1_domain_present())
 		return consumed_power;
 	else
 		return 0.0;
@@ -36,20 +36,23 @@ using namespace std;
 
 class gpu_rapl_device: public i915gpu {
 
-	c_rapl_interface rapl;
-	time_t		last_time;
+	c_rapl_interface *rapl;
+	uint64_t	last_time;
 	double		last_energy;
 	double 		consumed_power;
+	double		peak;
 	bool		device_valid;
 
 public:
 	gpu_rapl_device(i915gpu *parent);
+	~gpu_rapl_device() { put_rapl_interface(rapl); }
 	virtual const char * class_name(void) { return "GPU core";};
 	virtual const char * device_name(void) { return "GPU core";};
 	bool device_present() { return device_valid;}
 	virtual double power_usage(struct result_bundle *result, struct parameter_bundle *bundle);
 	virtual void start_measurement(void);
 	virtual void end_measurement(void);
+	virtual double peak_power(void) { return peak; };
 
 };
 
@@ -51,6 +51,7 @@ extern "C" {
 #include <net/if.h>
 #include <linux/sockios.h>
 #include <sys/ioctl.h>
+#include <pthread.h>
 #include <unistd.h>
 
 static map<string, class network *> nics;
@@ -72,6 +73,9 @@ static inline __u32 ethtool_cmd_speed(struct ethtool_cmd *ep)
 
 #endif
 
+static pthread_mutex_t proc_net_dev_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* shared by all nics, which take their snapshots in parallel */
 static void do_proc_net_dev(void)
 {
 	static time_t last_time;
@@ -80,14 +84,20 @@ static void do_proc_net_dev(void)
 	char line[4096];
 	char *c, *c2;
 
-	if (time(NULL) == last_time)
+	pthread_mutex_lock(&proc_net_dev_lock);
+
+	if (time(NULL) == last_time) {
+		pthread_mutex_unlock(&proc_net_dev_lock);
 		return;
+	}
 
 	last_time = time(NULL);
 
 	file.open("/proc/net/dev", ios::in);
-	if (!file)
+	if (!file) {
+		pthread_mutex_unlock(&proc_net_dev_lock);
 		return;
+	}
 
 	file.getline(line, 4096);
 	file.getline(line, 4096);
@@ -121,6 +131,7 @@ static void do_proc_net_dev(void)
 		dev->pkts = pkt;
 	}
 	file.close();
+	pthread_mutex_unlock(&proc_net_dev_lock);
 }
 
 
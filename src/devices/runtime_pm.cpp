@@ -40,11 +40,18 @@
 
 runtime_pmdevice::runtime_pmdevice(const char *_name, const char *path) : device()
 {
+	char filename[PATH_MAX];
+
 	pt_strcpy(sysfs_path, path);
 	register_sysfs_path(sysfs_path);
 	pt_strcpy(name, _name);
 	snprintf(humanname, sizeof(humanname), "runtime-%s", _name);
 
+	snprintf(filename, sizeof(filename), "%s/power/runtime_suspended_time", sysfs_path);
+	suspended_time.set_path(filename);
+	snprintf(filename, sizeof(filename), "%s/power/runtime_active_time", sysfs_path);
+	active_time.set_path(filename);
+
 	index = get_param_index(humanname);
 	r_index = get_result_index(humanname);
 
@@ -58,47 +65,21 @@ runtime_pmdevice::runtime_pmdevice(const char *_name, const char *path) : device
 
 void runtime_pmdevice::start_measurement(void)
 {
-	char filename[PATH_MAX];
-	ifstream file;
-
 	before_suspended_time = 0;
 	before_active_time = 0;
-        after_suspended_time = 0;
+	after_suspended_time = 0;
 	after_active_time = 0;
 
-	snprintf(filename, sizeof(filename), "%s/power/runtime_suspended_time", sysfs_path);
-	file.open(filename, ios::in);
-	if (!file)
-		return;
-	file >> before_suspended_time;
-	file.close();
-
-	snprintf(filename, sizeof(filename), "%s/power/runtime_active_time", sysfs_path);
-	file.open(filename, ios::in);
-	if (!file)
+	if (!suspended_time.read_u64(&before_suspended_time))
 		return;
-	file >> before_active_time;
-	file.close();
+	active_time.read_u64(&before_active_time);
 }
 
 void runtime_pmdevice::end_measurement(void)
 {
-	char filename[PATH_MAX];
-	ifstream file;
-
-	snprintf(filename, sizeof(filename), "%s/power/runtime_suspended_time", sysfs_path);
-	file.open(filename, ios::in);
-	if (!file)
-		return;
-	file >> after_suspended_time;
-	file.close();
-
-	snprintf(filename, sizeof(filename), "%s/power/runtime_active_time", sysfs_path);
-	file.open(filename, ios::in);
-	if (!file)
+	if (!suspended_time.read_u64(&after_suspended_time))
 		return;
-	file >> after_active_time;
-	file.close();
+	active_time.read_u64(&after_active_time);
 }
 
 double runtime_pmdevice::utilization(void) /* percentage */
@@ -29,10 +29,13 @@
 
 #include "device.h"
 #include "../parameters/parameters.h"
+#include "../lib.h"
 
 class runtime_pmdevice: public device {
 	uint64_t before_suspended_time, before_active_time;
 	uint64_t after_suspended_time, after_active_time;
+	sysfs_attr suspended_time;
+	sysfs_attr active_time;
 	char sysfs_path[PATH_MAX];
 	char name[4096];
 	char humanname[4096];
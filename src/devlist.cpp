@@ -32,6 +32,9 @@
 #include <time.h>
 #include <sys/stat.h>
 #include <vector>
+#include <map>
+#include <set>
+#include <string>
 #include <algorithm>
 #include <unistd.h>
 #include <sys/types.h>
@@ -50,6 +53,7 @@ using namespace std;
 
 #include "process/process.h"
 #include "devices/device.h"
+#include "perf/perf_record.h"
 /*
 
 * collect list of processes that have devices open
@@ -63,8 +67,8 @@ using namespace std;
 
 */
 
-static vector<struct devuser *> one;
-static vector<struct devuser *> two;
+static vector<struct devuser> one;
+static vector<struct devuser> two;
 static vector<struct devpower *> devpower;
 
 static int phase;
@@ -73,111 +77,208 @@ static int phase;
  * 1 - one = after,   two = before
  */
 
+/*
+ * The fd tables of most processes do not change between windows. Keep the
+ * /dev files each pid has open and only re-read a pid when it is new, was
+ * replaced (different start time) or its number of open fds changed. Since
+ * Linux 6.2 the size of /proc/<pid>/fd is that number; older kernels report
+ * 0 (and procfs never updates the directory mtime), so there the cache is
+ * not used at all and every pid is read directly, as before. An fd swapped
+ * for another one leaves the count unchanged, so every entry is re-read
+ * after FD_RESCAN_AGE scans regardless.
+ */
+struct pid_fds {
+	unsigned long long	start_time;
+	off_t			nr_fds;
+	unsigned int		age;
+	unsigned int		generation;
+	char			comm[32];
+	vector<const char *>	devices;
+};
+
+#define FD_RESCAN_AGE	8
+
+static map<unsigned int, struct pid_fds> fd_cache;
+static unsigned int fd_generation;
+static set<string> device_names;
+
+/*
+ * Devices are named by a piece of their /dev path ("usb/001/002",
+ * "pcmC0D0p") and charge every node whose path contains that piece.
+ * Index the openers by (interned) node, so a device matches each distinct
+ * open node once instead of every opener of it. Rebuilt lazily after each
+ * collect_open_devices() pass.
+ */
+static map<const char *, vector<const struct devuser *> > openers_by_node;
+static bool opener_index_valid;
+
+/* does the size of a /proc/<pid>/fd directory count its fds? */
+static bool fd_count_in_size(void)
+{
+	static int valid = -1;
+	struct stat st;
+
+	/* we have stdin/stdout/stderr open, so a working count is never 0 */
+	if (valid < 0)
+		valid = stat("/proc/self/fd", &st) == 0 && st.st_size > 0;
+	return valid;
+}
+
+static const char *intern_device(const char *name)
+{
+	return device_names.insert(name).first->c_str();
+}
+
 void clean_open_devices()
 {
 	unsigned int i=0;
 
-	for (i = 0; i < one.size(); i++) {
-		free(one[i]);
-	}
-
-	for (i = 0; i < two.size(); i++) {
-		free(two[i]);
-	}
+	one.clear();
+	two.clear();
+	openers_by_node.clear();
+	opener_index_valid = false;
+	fd_cache.clear();
+	device_names.clear();
 
 	for (i = 0; i < devpower.size(); i++){
 		free(devpower[i]);
 	}
 }
 
-void collect_open_devices(void)
+static bool ignored_device(const char *link)
+{
+	if (strcmp(link, "/dev/null") == 0)
+		return true;
+	if (strcmp(link, "/dev/.udev/queue.bin") == 0)
+		return true;
+	if (strcmp(link, "/dev/initctl") == 0)
+		return true;
+	if (strcmp(link, "/dev/ptmx") == 0)
+		return true;
+	if (strstr(link, "/dev/pts/"))
+		return true;
+	if (strstr(link, "/dev/shm/"))
+		return true;
+	if (strstr(link, "/dev/urandom"))
+		return true;
+	if (strstr(link, "/dev/tty"))
+		return true;
+
+	return strncmp(link, "/dev", 4) != 0;
+}
+
+static void read_pid_fds(const char *pid, struct pid_fds *fds)
 {
 	struct dirent *entry;
 	DIR *dir;
 	char filename[PATH_MAX];
 	char link[PATH_MAX];
+
+	fds->devices.clear();
+	fds->comm[0] = '\0';
+
+	snprintf(filename, sizeof(filename), "/proc/%s/fd/", pid);
+	dir = opendir(filename);
+	if (!dir)
+		return;
+	while ((entry = readdir(dir))) {
+		int ret;
+
+		if (!isdigit(entry->d_name[0]))
+			continue;
+		snprintf(filename, sizeof(filename), "/proc/%s/fd/%s", pid, entry->d_name);
+		ret = readlink(filename, link, sizeof(link) - 1);
+		if (ret < 0)
+			continue;
+		link[ret] = '\0';
+		if (ignored_device(link))
+			continue;
+		link[251] = '\0';
+		/* most processes have no /dev files open; only name those that do */
+		if (fds->devices.empty()) {
+			strncpy(fds->comm, read_sysfs_string("/proc/%s/comm", pid).c_str(), 31);
+			fds->comm[31] = '\0';
+		}
+		fds->devices.push_back(intern_device(link));
+	}
+	closedir(dir);
+}
+
+void collect_open_devices(void)
+{
+	struct dirent *entry;
+	DIR *dir;
+	char filename[PATH_MAX];
+	map<unsigned int, struct pid_fds>::iterator it;
+	vector<struct devuser> *target;
+	struct pid_fds uncached;
+	struct devuser dev;
 	unsigned int i;
-	vector<struct devuser *> *target;
 
 	if (phase == 1)
 		target = &one;
 	else
 		target = &two;
 
-	for (i = 0; i < target->size(); i++) {
-		free((*target)[i]);
-	}
-	target->resize(0);
-
+	target->clear();
+	fd_generation++;
+	opener_index_valid = false;
 
 	dir = opendir("/proc/");
 	if (!dir)
 		return;
-	while (1) {
-		struct dirent *entry2;
-		DIR *dir2;
-		entry = readdir(dir);
-
-		if (!entry)
-			break;
-		if (entry->d_name[0] == '.')
-			continue;
-		if (strcmp(entry->d_name, "self") == 0)
+	while ((entry = readdir(dir))) {
+		struct pid_fds *fds;
+		unsigned long long start_time;
+		unsigned int pid;
+		struct stat st;
+		bool fresh;
+
+		if (!isdigit(entry->d_name[0]))
 			continue;
 
-		snprintf(filename, sizeof(filename), "/proc/%s/fd/", entry->d_name);
+		pid = strtoull(entry->d_name, NULL, 10);
 
-		dir2 = opendir(filename);
-		if (!dir2)
-			continue;
-		while (1) {
-			int ret;
-			struct devuser * dev;
-			entry2 = readdir(dir2);
-			if (!entry2)
-				break;
-			if (!isdigit(entry2->d_name[0]))
-				continue;
-			snprintf(filename, sizeof(filename), "/proc/%s/fd/%s", entry->d_name, entry2->d_name);
-			memset(link, 0, sizeof(link));
-			ret = readlink(filename, link, sizeof(link) - 1);
-			if (ret < 0)
+		if (!fd_count_in_size()) {
+			fds = &uncached;
+			read_pid_fds(entry->d_name, fds);
+		} else {
+			snprintf(filename, sizeof(filename), "/proc/%s/fd/", entry->d_name);
+			if (stat(filename, &st) < 0)
 				continue;
 
-			if (strcmp(link, "/dev/null") == 0)
-				continue;
-			if (strcmp(link, "/dev/.udev/queue.bin") == 0)
-				continue;
-			if (strcmp(link, "/dev/initctl") == 0)
-				continue;
-			if (strcmp(link, "/dev/ptmx") == 0)
-				continue;
-			if (strstr(link, "/dev/pts/"))
-				continue;
-			if (strstr(link, "/dev/shm/"))
-				continue;
-			if (strstr(link, "/dev/urandom"))
-				continue;
-			if (strstr(link, "/dev/tty"))
-				continue;
-
-			if (strncmp(link, "/dev", 4)==0) {
-				dev = (struct devuser *)malloc(sizeof(struct devuser));
-				if (!dev)
-					continue;
-				dev->pid = strtoull(entry->d_name, NULL, 10);
-				strncpy(dev->device, link, 251);
-				dev->device[251] = '\0';
-				strncpy(dev->comm, read_sysfs_string("/proc/%s/comm", entry->d_name).c_str(), 31);
-				dev->comm[31] = '\0';
-				target->push_back(dev);
-
+			start_time = read_pid_start_time(pid);
+
+			fds = &fd_cache[pid];
+			fresh = fds->generation == 0 || fds->start_time != start_time ||
+				fds->nr_fds != st.st_size ||
+				++fds->age >= FD_RESCAN_AGE;
+			if (fresh) {
+				read_pid_fds(entry->d_name, fds);
+				fds->start_time = start_time;
+				fds->nr_fds = st.st_size;
+				fds->age = 0;
 			}
+			fds->generation = fd_generation;
+		}
+
+		dev.pid = pid;
+		memcpy(dev.comm, fds->comm, sizeof(dev.comm));
+		for (i = 0; i < fds->devices.size(); i++) {
+			dev.device = fds->devices[i];
+			target->push_back(dev);
 		}
-		closedir(dir2);
 	}
 	closedir(dir);
 
+	/* forget pids that are gone */
+	for (it = fd_cache.begin(); it != fd_cache.end(); ) {
+		if (it->second.generation != fd_generation)
+			fd_cache.erase(it++);
+		else
+			++it;
+	}
+
 	if (phase)
 		phase = 0;
 	else
@@ -185,23 +286,40 @@ void collect_open_devices(void)
 }
 
 
+static void index_openers(const vector<struct devuser> &users)
+{
+	unsigned int i;
+
+	for (i = 0; i < users.size(); i++)
+		openers_by_node[users[i].device].push_back(&users[i]);
+}
+
+static void build_opener_index(void)
+{
+	openers_by_node.clear();
+	index_openers(one);
+	index_openers(two);
+	opener_index_valid = true;
+}
+
 /* returns 0 if no process is identified as having the device open and a value > 0 otherwise */
 int charge_device_to_openers(const char *devstring, double power, class device *_dev)
 {
+	map<const char *, vector<const struct devuser *> >::iterator node;
+	vector<const struct devuser *> users;
+	set<string> comms;
 	unsigned int i;
 	int openers = 0;
 	class process *proc;
-	/* 1. count the number of openers */
 
-	for (i = 0; i < one.size(); i++) {
-		if (strstr(one[i]->device, devstring))
-			openers++;
-	}
-	for (i = 0; i < two.size(); i++) {
-		if (strstr(two[i]->device, devstring))
-			openers++;
-	}
+	if (!opener_index_valid)
+		build_opener_index();
 
+	/* 1. find the openers */
+	for (node = openers_by_node.begin(); node != openers_by_node.end(); ++node)
+		if (strstr(node->first, devstring))
+			users.insert(users.end(), node->second.begin(), node->second.end());
+	openers = users.size();
 
 	/* 2. divide power by this number */
 
@@ -212,31 +330,18 @@ int charge_device_to_openers(const char *devstring, double power, class device *
 
 	/* 3. for each process that has it open, add the charge */
 
-	for (i = 0; i < one.size(); i++)
-		if (strstr(one[i]->device, devstring)) {
-			proc = find_create_process(one[i]->comm, one[i]->pid);
-			if (proc) {
-				proc->power_charge += power;
-				if (strlen(_dev->guilty) < 2000 && strstr(_dev->guilty, one[i]->comm) == NULL) {
-					strcat(_dev->guilty, one[i]->comm);
-					strcat(_dev->guilty, " ");
-				}
-			}
-		}
-
-	for (i = 0; i < two.size(); i++)
-		if (strstr(two[i]->device, devstring)) {
-			proc = find_create_process(two[i]->comm, two[i]->pid);
-			if (proc) {
-				proc->power_charge += power;
-				if (strlen(_dev->guilty) < 2000 && strstr(_dev->guilty, two[i]->comm) == NULL) {
-					strcat(_dev->guilty, two[i]->comm);
-					strcat(_dev->guilty, " ");
-				}
-			}
+	for (i = 0; i < users.size(); i++) {
+		proc = find_create_process(users[i]->comm, users[i]->pid);
+		if (!proc)
+			continue;
+		proc->power_charge += power;
+		if (!comms.insert(users[i]->comm).second)
+			continue;
+		if (strlen(_dev->guilty) < 2000 && strstr(_dev->guilty, users[i]->comm) == NULL) {
+			strcat(_dev->guilty, users[i]->comm);
+			strcat(_dev->guilty, " ");
 		}
-
-
+	}
 
 	return openers;
 }
@@ -287,17 +392,94 @@ void run_devpower_list(void)
 
 }
 
-static bool devlist_sort(struct devuser * i, struct devuser * j)
+static void save_devusers(class trace_snapshot &snapshot, const vector<struct devuser> &users)
+{
+	unsigned int i;
+
+	snapshot.put_u32(users.size());
+	for (i = 0; i < users.size(); i++) {
+		snapshot.put_u32(users[i].pid);
+		snapshot.put_string(users[i].comm);
+		snapshot.put_string(users[i].device);
+	}
+}
+
+static void load_devusers(class trace_snapshot &snapshot, vector<struct devuser> &users)
+{
+	struct devuser dev;
+	unsigned int i, count;
+
+	users.clear();
+	count = snapshot.get_u32();
+	for (i = 0; i < count && !snapshot.failed(); i++) {
+		dev.pid = snapshot.get_u32();
+		snapshot.get_string(dev.comm, sizeof(dev.comm));
+		dev.device = intern_device(snapshot.get_string().c_str());
+		users.push_back(dev);
+	}
+}
+
+/*
+ * Both opener lists and the power devices registered to be charged to
+ * them; the devices are saved as their index in all_devices, which
+ * save_devices() writes in the same snapshot.
+ */
+void save_open_devices(class trace_snapshot &snapshot)
+{
+	unsigned int i, j, count = 0;
+
+	snapshot.put_u32(phase);
+	save_devusers(snapshot, one);
+	save_devusers(snapshot, two);
+
+	for (i = 0; i < devpower.size(); i++)
+		if (find(all_devices.begin(), all_devices.end(), devpower[i]->dev) != all_devices.end())
+			count++;
+
+	snapshot.put_u32(count);
+	for (i = 0; i < devpower.size(); i++) {
+		j = find(all_devices.begin(), all_devices.end(), devpower[i]->dev) - all_devices.begin();
+		if (j == all_devices.size())
+			continue;
+		snapshot.put_string(devpower[i]->device);
+		snapshot.put_double(devpower[i]->power);
+		snapshot.put_u32(j);
+	}
+}
+
+void load_open_devices(class trace_snapshot &snapshot)
+{
+	unsigned int i, index, count;
+	string devstring;
+	double power;
+
+	phase = snapshot.get_u32() ? 1 : 0;
+	load_devusers(snapshot, one);
+	load_devusers(snapshot, two);
+	opener_index_valid = false;
+
+	clear_devpower();
+	count = snapshot.get_u32();
+	for (i = 0; i < count && !snapshot.failed(); i++) {
+		devstring = snapshot.get_string();
+		power = snapshot.get_double();
+		index = snapshot.get_u32();
+		if (!snapshot.failed() && index < all_devices.size())
+			register_devpower(devstring.c_str(), power, all_devices[index]);
+	}
+}
+
+static bool devlist_sort(const struct devuser &i, const struct devuser &j)
 {
-	if (i->pid != j->pid)
-		return i->pid < j->pid;
+	if (i.pid != j.pid)
+		return i.pid < j.pid;
 
-	return (strcmp(i->device, j->device)< 0);
+	return (strcmp(i.device, j.device)< 0);
 }
 
 void report_show_open_devices(void)
 {
-	vector<struct devuser *> *target;
+	vector<struct devuser> *target;
 	unsigned int i;
 	char prev[128], proc[128];
 	int idx, cols, rows;
@@ -332,14 +514,14 @@ void report_show_open_devices(void)
 
 	for (i = 0; i < target->size(); i++) {
 		proc[0] = 0;
-		if (strcmp(prev, (*target)[i]->comm) != 0)
-			snprintf(proc, sizeof(proc), "%s", (*target)[i]->comm);
+		if (strcmp(prev, (*target)[i].comm) != 0)
+			snprintf(proc, sizeof(proc), "%s", (*target)[i].comm);
 
 		process_data[idx]=string(proc);
 		idx+=1;
-		process_data[idx]=string((*target)[i]->device);
+		process_data[idx]=string((*target)[i].device);
 		idx+=1;
-		snprintf(prev, sizeof(prev), "%s", (*target)[i]->comm);
+		snprintf(prev, sizeof(prev), "%s", (*target)[i].comm);
 	}
 
 	/* Report Output */
@@ -4,7 +4,7 @@
 struct devuser {
 	unsigned int pid;
 	char comm[32];
-	char device[252];
+	const char *device;	/* interned, valid until clean_open_devices() */
 };
 
 class device;
@@ -24,4 +24,8 @@ extern void run_devpower_list(void);
 
 extern void report_show_open_devices(void);
 
+class trace_snapshot;
+extern void save_open_devices(class trace_snapshot &snapshot);
+extern void load_open_devices(class trace_snapshot &snapshot);
+
 #endif
@@ -24,6 +24,8 @@
  *	Peter Anvin
  */
 #include <map>
+#include <vector>
+#include <algorithm>
 #include <string.h>
 #include <iostream>
 #include <utility>
@@ -59,8 +61,7 @@ extern "C" {
 #include <ncurses.h>
 #include <fcntl.h>
 #include <glob.h>
-
-static int kallsyms_read = 0;
+#include <pthread.h>
 
 int is_turbo(uint64_t freq, uint64_t max, uint64_t maxmo)
 {
@@ -111,49 +112,93 @@ char *hz_to_human(unsigned long hz, char *buffer, int digits)
 
 using namespace std;
 
-map<unsigned long, string> kallsyms;
+/*
+ * Kernel symbols, sorted by address. Names live back to back in one blob,
+ * kallsyms_names[i] is the offset of the name of kallsyms_addr[i].
+ */
+static int kallsyms_read = 0;
+static vector<uint64_t> kallsyms_addr;
+static vector<uint32_t> kallsyms_names;
+static vector<char> kallsyms_blob;
+
+static bool kallsyms_sort(const pair<uint64_t, uint32_t> &a, const pair<uint64_t, uint32_t> &b)
+{
+	return a.first < b.first;
+}
 
 static void read_kallsyms(void)
 {
-	ifstream file;
-	char line[1024];
+	vector<pair<uint64_t, uint32_t> > syms;
+	vector<char> text;
+	char *line, *end, *c, *name;
+	uint64_t address;
+	size_t size = 0;
+	ssize_t n;
+	unsigned int i;
+	int fd;
+
 	kallsyms_read = 1;
 
-	file.open("/proc/kallsyms", ios::in);
+	/* procfs can't be mmap'ed; slurp it in large reads instead */
+	fd = open("/proc/kallsyms", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	text.resize(1 << 20);
+	while ((n = read(fd, &text[size], text.size() - size - 1)) > 0) {
+		size += n;
+		if (text.size() - size < 65536)
+			text.resize(text.size() * 2);
+	}
+	close(fd);
+	text[size] = 0;
 
-	while (file) {
-		char *c = NULL, *c2 = NULL;
-		unsigned long address = 0;
-		memset(line, 0, 1024);
-		file.getline(line, 1024);
-		c = strchr(line, ' ');
-		if (!c)
-			continue;
-		*c = 0;
-		c2 = c + 1;
-		if (*c2) c2++;
-		if (*c2) c2++;
+	/* "<address> <type> <name>[\t[module]]" */
+	for (line = &text[0]; line < &text[0] + size; line = end + 1) {
+		end = strchr(line, '\n');
+		if (!end)
+			end = &text[0] + size;
+		*end = 0;
 
-		address = strtoull(line, NULL, 16);
-		c = strchr(c2, '\t');
+		address = strtoull(line, &c, 16);
+		if (address == 0 || *c != ' ' || !c[1] || c[2] != ' ')
+			continue;
+		name = c + 3;
+		c = strchr(name, '\t');
 		if (c)
 			*c = 0;
-		if (address != 0)
-			kallsyms[address] = c2;
+
+		syms.push_back(make_pair(address, (uint32_t)kallsyms_blob.size()));
+		kallsyms_blob.insert(kallsyms_blob.end(), name, name + strlen(name) + 1);
+	}
+
+	stable_sort(syms.begin(), syms.end(), kallsyms_sort);
+
+	kallsyms_addr.reserve(syms.size());
+	kallsyms_names.reserve(syms.size());
+	for (i = 0; i < syms.size(); i++) {
+		/* aliases: like before, the last one listed wins */
+		if (!kallsyms_addr.empty() && kallsyms_addr.back() == syms[i].first) {
+			kallsyms_names.back() = syms[i].second;
+			continue;
+		}
+		kallsyms_addr.push_back(syms[i].first);
+		kallsyms_names.push_back(syms[i].second);
 	}
-	file.close();
 }
 
+/* name of the symbol containing address; loaded on first use */
 const char *kernel_function(uint64_t address)
 {
-	const char *c;
+	vector<uint64_t>::iterator it;
+
 	if (!kallsyms_read)
 		read_kallsyms();
 
-	c = kallsyms[address].c_str();
-	if (!c)
+	it = upper_bound(kallsyms_addr.begin(), kallsyms_addr.end(), address);
+	if (it == kallsyms_addr.begin())
 		return "";
-	return c;
+
+	return &kallsyms_blob[kallsyms_names[it - kallsyms_addr.begin() - 1]];
 }
 
 static int _max_cpu;
@@ -185,79 +230,127 @@ void write_sysfs(const string &filename, const string &value)
 	}
 }
 
+/* read a small attribute file in one go; returns the length or -1 */
+static int read_small_file(const char *filename, char *buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = 0;
+	return n;
+}
+
+uint64_t parse_u64(const char *str, const char **end)
+{
+	uint64_t value = 0;
+
+	while (*str == ' ' || *str == '\t')
+		str++;
+	while (*str >= '0' && *str <= '9')
+		value = value * 10 + (*str++ - '0');
+	if (end)
+		*end = str;
+	return value;
+}
+
 int read_sysfs(const string &filename, bool *ok)
 {
-	ifstream file;
-	int i;
+	char content[64];
+	char *end;
+	long i;
 
-	file.open(filename.c_str(), ios::in);
-	if (!file) {
+	if (read_small_file(filename.c_str(), content, sizeof(content)) < 0) {
 		if (ok)
 			*ok = false;
 		return 0;
 	}
-	try
-	{
-		file >> i;
-		if (ok)
-			*ok = true;
-	} catch (std::exception &exc) {
-		if (ok)
-			*ok = false;
-		i = 0;
-	}
-	file.close();
-	return i;
+	i = strtol(content, &end, 10);
+	if (ok)
+		*ok = end != content;
+	return end != content ? i : 0;
 }
 
 string read_sysfs_string(const string &filename)
 {
-	ifstream file;
 	char content[4096];
 	char *c;
 
-	file.open(filename.c_str(), ios::in);
-	if (!file)
-		return "";
-	try
-	{
-		file.getline(content, 4096);
-		file.close();
-		c = strchr(content, '\n');
-		if (c)
-			*c = 0;
-	} catch (std::exception &exc) {
-		file.close();
+	if (read_small_file(filename.c_str(), content, sizeof(content)) < 0)
 		return "";
-	}
+	c = strchr(content, '\n');
+	if (c)
+		*c = 0;
 	return content;
 }
 
 string read_sysfs_string(const char *format, const char *param)
 {
-	ifstream file;
-	char content[4096];
-	char *c;
 	char filename[PATH_MAX];
 
-
 	snprintf(filename, sizeof(filename), format, param);
+	return read_sysfs_string(string(filename));
+}
 
-	file.open(filename, ios::in);
-	if (!file)
-		return "";
-	try
-	{
-		file.getline(content, 4096);
-		file.close();
-		c = strchr(content, '\n');
-		if (c)
-			*c = 0;
-	} catch (std::exception &exc) {
-		file.close();
-		return "";
+sysfs_attr::sysfs_attr(void) : fd(-1)
+{
+}
+
+sysfs_attr::~sysfs_attr(void)
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+void sysfs_attr::set_path(const char *_path)
+{
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+	path = _path;
+}
+
+/*
+ * Re-read the whole attribute; the file is opened on first use and kept
+ * open, a failing read (e.g. the device went away) closes it again.
+ */
+int sysfs_attr::read(char *buf, size_t len)
+{
+	ssize_t n;
+
+	if (fd < 0) {
+		if (path.empty())
+			return -1;
+		fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return -1;
 	}
-	return content;
+
+	n = pread(fd, buf, len - 1, 0);
+	if (n < 0) {
+		close(fd);
+		fd = -1;
+		return -1;
+	}
+	buf[n] = 0;
+	return n;
+}
+
+bool sysfs_attr::read_u64(uint64_t *value)
+{
+	char buf[32];
+	const char *end;
+
+	if (read(buf, sizeof(buf)) <= 0)
+		return false;
+	*value = parse_u64(buf, &end);
+	return end != buf;
 }
 
 void align_string(char *buffer, size_t min_sz, size_t max_sz)
@@ -483,6 +576,81 @@ void process_glob(const char *d_glob, callback fn)
 	globfree(&g);
 }
 
+struct parallel_work {
+	parallel_callback fn;
+	void *arg;
+	unsigned int count;
+	volatile unsigned int next;
+};
+
+static void *parallel_worker(void *data)
+{
+	struct parallel_work *work = (struct parallel_work *)data;
+	unsigned int index;
+
+	while ((index = __sync_fetch_and_add(&work->next, 1)) < work->count)
+		work->fn(index, work->arg);
+	return NULL;
+}
+
+/* extra threads currently running across all (possibly nested) parallel_for calls */
+static volatile int parallel_busy;
+
+/*
+ * Run fn(0) .. fn(count - 1) on up to max_threads threads (default: one per
+ * online cpu), the calling thread included. Items are handed out one at a
+ * time, so fn must not depend on the order they are run in. Nested calls
+ * share the one-per-cpu budget and run inline once it is used up.
+ */
+void parallel_for(unsigned int count, parallel_callback fn, void *arg, unsigned int max_threads)
+{
+	struct parallel_work work;
+	pthread_t *threads;
+	unsigned int nr_threads, i, started;
+	int extra, busy, over;
+	long online;
+
+	work.fn = fn;
+	work.arg = arg;
+	work.count = count;
+	work.next = 0;
+
+	online = sysconf(_SC_NPROCESSORS_ONLN);
+	nr_threads = online > 0 ? online : 1;
+	if (max_threads && nr_threads > max_threads)
+		nr_threads = max_threads;
+	if (nr_threads > count)
+		nr_threads = count;
+
+	extra = nr_threads > 1 ? nr_threads - 1 : 0;
+	busy = __sync_add_and_fetch(&parallel_busy, extra);
+	over = busy - (online > 1 ? online - 1 : 0);
+	if (over > 0) {
+		if (over > extra)
+			over = extra;
+		__sync_sub_and_fetch(&parallel_busy, over);
+		extra -= over;
+	}
+
+	if (extra <= 0) {
+		parallel_worker(&work);
+		return;
+	}
+
+	threads = new pthread_t[extra];
+	started = 0;
+	for (i = 0; i < (unsigned int)extra; i++)
+		if (pthread_create(&threads[started], NULL, parallel_worker, &work) == 0)
+			started++;
+
+	parallel_worker(&work);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	delete [] threads;
+	__sync_sub_and_fetch(&parallel_busy, extra);
+}
+
 int get_user_input(char *buf, unsigned sz)
 {
 	fflush(stdout);
@@ -495,32 +663,106 @@ int get_user_input(char *buf, unsigned sz)
 	return ret || strlen(buf);
 }
 
-int read_msr(int cpu, uint64_t offset, uint64_t *value)
-{
+/*
+ * MSR device handles are kept open for the lifetime of the cpu topology;
+ * the residency snapshots read several registers per cpu every window and
+ * probing/opening the device node for each of them dominates the cost.
+ */
 #if defined(__i386__) || defined(__x86_64__)
-	ssize_t retval;
-	uint64_t msr;
+#define MSR_FD_UNKNOWN	-1
+#define MSR_FD_MISSING	-2
+
+static vector<int> msr_fds;
+static int msr_dev_style = -1;	/* 0: /dev/cpu/N/msr, 1: /dev/msrN */
+static pthread_mutex_t msr_lock = PTHREAD_MUTEX_INITIALIZER;	/* the cpu snapshots run in parallel */
+
+static int msr_path(int cpu, char *path, size_t len)
+{
+	if (msr_dev_style < 0) {
+		snprintf(path, len, "/dev/cpu/%d/msr", cpu);
+		if (access(path, R_OK) == 0) {
+			msr_dev_style = 0;
+		} else {
+			snprintf(path, len, "/dev/msr%d", cpu);
+			if (access(path, R_OK) != 0) {
+				fprintf(stderr,
+				 _("Model-specific registers (MSR)\
+				 not found (try enabling CONFIG_X86_MSR).\n"));
+				return -1;
+			}
+			msr_dev_style = 1;
+		}
+		return 0;
+	}
+
+	if (msr_dev_style == 0)
+		snprintf(path, len, "/dev/cpu/%d/msr", cpu);
+	else
+		snprintf(path, len, "/dev/msr%d", cpu);
+	return 0;
+}
+
+static int msr_fd(int cpu)
+{
+	char path[256];
 	int fd;
-	char msr_path[256];
 
-	snprintf(msr_path, sizeof(msr_path), "/dev/cpu/%d/msr", cpu);
+	if (cpu < 0)
+		return -1;
 
-	if (access(msr_path, R_OK) != 0){
-		snprintf(msr_path, sizeof(msr_path), "/dev/msr%d", cpu);
+	pthread_mutex_lock(&msr_lock);
+	if ((unsigned int)cpu >= msr_fds.size())
+		msr_fds.resize(cpu + 1, MSR_FD_UNKNOWN);
 
-		if (access(msr_path, R_OK) != 0){
-			fprintf(stderr,
-			 _("Model-specific registers (MSR)\
-			 not found (try enabling CONFIG_X86_MSR).\n"));
-			return -1;
-		}
+	if (msr_fds[cpu] != MSR_FD_UNKNOWN) {
+		fd = msr_fds[cpu];
+	} else if (msr_path(cpu, path, sizeof(path)) < 0) {
+		fd = msr_fds[cpu] = MSR_FD_MISSING;
+	} else {
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		msr_fds[cpu] = fd >= 0 ? fd : MSR_FD_MISSING;
 	}
+	pthread_mutex_unlock(&msr_lock);
+
+	return fd >= 0 ? fd : -1;
+}
+#endif
 
-	fd = open(msr_path, O_RDONLY);
+void open_msr_handles(int max_cpu)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	int cpu;
+
+	for (cpu = 0; cpu <= max_cpu; cpu++)
+		if (msr_fd(cpu) < 0 && msr_dev_style < 0)
+			break;
+#endif
+}
+
+void close_msr_handles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned int i;
+
+	for (i = 0; i < msr_fds.size(); i++)
+		if (msr_fds[i] >= 0)
+			close(msr_fds[i]);
+	msr_fds.clear();
+	msr_dev_style = -1;
+#endif
+}
+
+int read_msr(int cpu, uint64_t offset, uint64_t *value)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	ssize_t retval;
+	uint64_t msr;
+	int fd;
+
+	fd = msr_fd(cpu);
 	if (fd < 0)
 		return -1;
 	retval = pread(fd, &msr, sizeof msr, offset);
-	close(fd);
 	if (retval != sizeof msr) {
 		return -1;
 	}
@@ -532,27 +774,41 @@ int read_msr(int cpu, uint64_t offset, uint64_t *value)
 #endif
 }
 
-int write_msr(int cpu, uint64_t offset, uint64_t value)
+/*
+ * Read @count registers of one cpu through its cached handle. Returns the
+ * number of registers read; stops at the first one that fails.
+ */
+int read_msrs(int cpu, const uint64_t *offsets, uint64_t *values, int count)
 {
 #if defined(__i386__) || defined(__x86_64__)
-	ssize_t retval;
 	int fd;
-	char msr_path[256];
+	int i;
 
-	snprintf(msr_path, sizeof(msr_path), "/dev/cpu/%d/msr", cpu);
+	fd = msr_fd(cpu);
+	if (fd < 0)
+		return -1;
 
-	if (access(msr_path, R_OK) != 0){
-		snprintf(msr_path, sizeof(msr_path), "/dev/msr%d", cpu);
+	for (i = 0; i < count; i++)
+		if (pread(fd, &values[i], sizeof(uint64_t), offsets[i]) != sizeof(uint64_t))
+			break;
 
-		if (access(msr_path, R_OK) != 0){
-			fprintf(stderr,
-			 _("Model-specific registers (MSR)\
-			 not found (try enabling CONFIG_X86_MSR).\n"));
-			return -1;
-		}
-	}
+	return i;
+#else
+	return -1;
+#endif
+}
+
+int write_msr(int cpu, uint64_t offset, uint64_t value)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	ssize_t retval;
+	int fd;
+	char path[256];
+
+	if (msr_path(cpu, path, sizeof(path)) < 0)
+		return -1;
 
-	fd = open(msr_path, O_WRONLY);
+	fd = open(path, O_WRONLY);
 	if (fd < 0)
 		return -1;
 	retval = pwrite(fd, &value, sizeof value, offset);
@@ -62,6 +62,23 @@ extern void write_sysfs(const string &filename, const string &value);
 extern int read_sysfs(const string &filename, bool *ok = NULL);
 extern string read_sysfs_string(const string &filename);
 extern string read_sysfs_string(const char *format, const char *param);
+extern uint64_t parse_u64(const char *str, const char **end = NULL);
+
+/* an attribute that is re-read every window through a kept-open fd */
+class sysfs_attr {
+	int	fd;
+	string	path;
+
+	sysfs_attr(const sysfs_attr &);
+	sysfs_attr &operator=(const sysfs_attr &);
+public:
+	sysfs_attr(void);
+	~sysfs_attr(void);
+
+	void	set_path(const char *_path);
+	int	read(char *buf, size_t len);
+	bool	read_u64(uint64_t *value);
+};
 
 extern void format_watts(double W, char *buffer, unsigned int len);
 
@@ -82,10 +99,16 @@ template<size_t N> void pt_strcpy(char (&d)[N], const char *s)
 typedef void (*callback)(const char*);
 extern void process_directory(const char *d_name, callback fn);
 extern void process_glob(const char *glob, callback fn);
+
+typedef void (*parallel_callback)(unsigned int index, void *arg);
+extern void parallel_for(unsigned int count, parallel_callback fn, void *arg, unsigned int max_threads = 0);
 extern int utf_ok;
 extern int get_user_input(char *buf, unsigned sz);
 extern int read_msr(int cpu, uint64_t offset, uint64_t *value);
 extern int write_msr(int cpu, uint64_t offset, uint64_t value);
+extern int read_msrs(int cpu, const uint64_t *offsets, uint64_t *values, int count);
+extern void open_msr_handles(int max_cpu);
+extern void close_msr_handles(void);
 
 extern void align_string(char *buffer, size_t min_sz, size_t max_sz);
 
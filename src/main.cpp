@@ -42,9 +42,11 @@
 #include <pthread.h>
 
 #include "cpu/cpu.h"
+#include "cpu/rapl/rapl_interface.h"
 #include "process/process.h"
 #include "perf/perf.h"
 #include "perf/perf_bundle.h"
+#include "perf/perf_record.h"
 #include "lib.h"
 #include "../config.h"
 #include "instruction/instruction.h"
@@ -78,7 +80,13 @@ enum {
 	OPT_AUTO_TUNE = CHAR_MAX + 1,
 	OPT_AUTO_TUNE_DUMP,
 	OPT_EXTECH,
-	OPT_DEBUG
+	OPT_DEBUG,
+	OPT_STREAM,
+	OPT_RAPL_RATE,
+	OPT_FIT,
+	OPT_RECORD,
+	OPT_REPLAY,
+	OPT_JSON
 };
 
 static const struct option long_options[] =
@@ -90,10 +98,16 @@ static const struct option long_options[] =
 	{"csv",		optional_argument,	NULL,		 'C'},
 	{"debug",	no_argument,		&debug_learning, OPT_DEBUG},
 	{"extech",	optional_argument,	NULL,		 OPT_EXTECH},
+	{"fit",		required_argument,	NULL,		 OPT_FIT},
 	{"html",	optional_argument,	NULL,		 'r'},
 	{"iteration",	optional_argument,	NULL,		 'i'},
+	{"json",	optional_argument,	NULL,		 OPT_JSON},
 	{"quiet",	no_argument,		NULL,		 'q'},
+	{"rapl-rate",	required_argument,	NULL,		 OPT_RAPL_RATE},
+	{"record",	required_argument,	NULL,		 OPT_RECORD},
+	{"replay",	required_argument,	NULL,		 OPT_REPLAY},
 	{"sample",	optional_argument,	NULL,		 's'},
+	{"stream",	no_argument,		NULL,		 OPT_STREAM},
 	{"time",	optional_argument,	NULL,		 't'},
 	{"workload",	optional_argument,	NULL,		 'w'},
 	{"version",	no_argument,		NULL,		 'V'},
@@ -129,10 +143,16 @@ static void print_usage()
 	printf(" -C, --csv%s\t %s\n", _("[=filename]"), _("generate a csv report"));
 	printf("     --debug\t\t %s\n", _("run in \"debug\" mode"));
 	printf("     --extech%s\t %s\n", _("[=devnode]"), _("uses an Extech Power Analyzer for measurements"));
+	printf("     --fit%s\t %s\n", _("=method"), _("power model fitting: heuristic (default) or nnls"));
 	printf(" -r, --html%s\t %s\n", _("[=filename]"), _("generate a html report"));
 	printf(" -i, --iteration%s\n", _("[=iterations] number of times to run each test"));
+	printf("     --json%s\t %s\n", _("[=filename]"), _("append one JSON object per measurement to a file, - for stdout"));
 	printf(" -q, --quiet\t\t %s\n", _("suppress stderr output"));
+	printf("     --rapl-rate%s %s\n", _("=hz"), _("RAPL energy sampling rate, 0 to disable"));
+	printf("     --record%s\t %s\n", _("=file"), _("save the trace events of all measurements to a file"));
+	printf("     --replay%s\t %s\n", _("=file"), _("analyze trace events saved with --record instead of live ones"));
 	printf(" -s, --sample%s\t %s\n", _("[=seconds]"), _("interval for power consumption measurement"));
+	printf("     --stream\t\t %s\n", _("drain trace events continuously during the measurement"));
 	printf(" -t, --time%s\t %s\n", _("[=seconds]"), _("generate a report for 'x' seconds"));
 	printf(" -w, --workload%s %s\n", _("[=workload]"), _("file to execute for workload"));
 	printf(" -V, --version\t\t %s\n", _("print version information"));
@@ -146,6 +166,10 @@ static void do_sleep(int seconds)
 	time_t target;
 	int delta;
 
+	/* a replayed trace already covers the whole window */
+	if (trace_replaying())
+		return;
+
 	if (!ncurses_initialized()) {
 		sleep(seconds);
 		return;
@@ -217,12 +241,49 @@ extern "C" {
 	}
 }
 
+/*
+ * The cpu counters, device statistics and open device lists a window ends
+ * with go into the recording, as the reports see them. A replay reads them
+ * back in place of its own measurements, which would describe the machine
+ * it runs on, before the processes are charged for the devices.
+ */
+static void record_measurement(void)
+{
+	class trace_snapshot snapshot;
+
+	save_cpu_state(snapshot);
+	save_result_snapshot(snapshot);
+	save_power_meters(snapshot);
+	save_devices(snapshot);
+	save_open_devices(snapshot);
+	record_snapshot(SNAPSHOT_WINDOW, snapshot);
+}
+
+static void replay_measurement(void)
+{
+	class trace_snapshot snapshot;
+
+	if (!replay_snapshot(SNAPSHOT_WINDOW, snapshot))
+		return;
+
+	load_cpu_state(snapshot);
+	load_result_snapshot(snapshot);
+	load_power_meters(snapshot);
+	load_devices(snapshot);
+	load_open_devices(snapshot);
+}
+
 void one_measurement(int seconds, int sample_interval, char *workload)
 {
-	create_all_usb_devices();
+	bool live = !trace_replaying();
+
+	if (live)
+		create_all_usb_devices();
 	start_power_measurement();
-	devices_start_measurement();
-	start_devfreq_measurement();
+	if (live) {
+		devices_start_measurement();
+		start_devfreq_measurement();
+	}
 	start_process_measurement();
 	start_cpu_measurement();
 
@@ -251,12 +312,16 @@ void one_measurement(int seconds, int sample_interval, char *workload)
 	}
 	end_cpu_measurement();
 	end_process_measurement();
-	collect_open_devices();
-	end_devfreq_measurement();
-	devices_end_measurement();
+	if (live) {
+		collect_open_devices();
+		end_devfreq_measurement();
+		devices_end_measurement();
+	}
 	end_power_measurement();
 
 	process_cpu_data();
+	if (!live)
+		replay_measurement();
 	process_process_data();
 
 	/* output stats */
@@ -276,15 +341,20 @@ void one_measurement(int seconds, int sample_interval, char *workload)
 
 	global_power();
 	compute_bundle();
+	if (trace_recording())
+		record_measurement();
 
 	show_report_devices();
-	report_show_open_devices();	                                                                                 
-	
+	report_show_open_devices();
+
 	report_devices();
-	display_devfreq_devices();
-	report_devfreq_devices();
-	ahci_create_device_stats_table();
-	store_results(measurement_time);
+	if (live) {
+		display_devfreq_devices();
+		report_devfreq_devices();
+		ahci_create_device_stats_table();
+		/* only live measurements are good for learning */
+		store_results(measurement_time);
+	}
 	end_cpu_data();
 }
 
@@ -313,15 +383,19 @@ void make_report(int time, char *workload, int iterations, int sample_interval,
 		initialize_wakeup();
 		/* and then the real measurement */
 		one_measurement(time, sample_interval, workload);
-		report_show_tunables();
-		report_show_wakeup();
+		if (!trace_replaying()) {
+			report_show_tunables();
+			report_show_wakeup();
+		}
 		finish_report_output();
 		clear_tuning();
 	}
-	/* and wrap up */
-	learn_parameters(50, 0);
-	save_all_results("saved_results.powertop");
-	save_parameters("saved_parameters.powertop");
+	/* and wrap up; the recorded devices don't take parameters to learn */
+	if (!trace_replaying()) {
+		learn_parameters(50, 0);
+		save_all_results("saved_results.powertop");
+		save_parameters("saved_parameters.powertop");
+	}
 	end_pci_access();
 	exit(0);
 }
@@ -350,16 +424,13 @@ static int get_nr_open(void) {
 	return nr_open;
 }
 
-static void powertop_init(int auto_tune)
+/* root, kernel modules and debugfs; not needed to replay a recorded trace */
+static void prepare_system(int auto_tune)
 {
-	static char initialized = 0;
 	int ret;
 	struct statfs st_fs;
 	struct rlimit rlmt;
 
-	if (initialized)
-		return;
-
 	checkroot();
 
 	rlmt.rlim_cur = rlmt.rlim_max = get_nr_open();
@@ -390,6 +461,17 @@ static void powertop_init(int auto_tune)
 			}
 		}
 	}
+}
+
+static void powertop_init(int auto_tune)
+{
+	static char initialized = 0;
+
+	if (initialized)
+		return;
+
+	if (!trace_replaying())
+		prepare_system(auto_tune);
 
 	srand(time(NULL));
 
@@ -402,8 +484,11 @@ static void powertop_init(int auto_tune)
 	load_parameters("saved_parameters.powertop");
 
 	enumerate_cpus();
-	create_all_devices();
-	create_all_devfreq_devices();
+	/* a replay only knows the devices of the recording */
+	if (!trace_replaying()) {
+		create_all_devices();
+		create_all_devfreq_devices();
+	}
 	detect_power_meters();
 
 	register_parameter("base power", 100, 0.5);
@@ -421,6 +506,7 @@ static void powertop_init(int auto_tune)
 
 void clean_shutdown()
 {
+	trace_record_close();
 	close_results();
 	clean_open_devices();
 	clear_all_devices();
@@ -483,6 +569,16 @@ int main(int argc, char **argv)
 			checkroot();
 			extech_power_meter(optarg ? optarg : "/dev/ttyUSB0");
 			break;
+		case OPT_FIT:
+			if (!strcmp(optarg, "nnls"))
+				learn_method = LEARN_NNLS;
+			else if (!strcmp(optarg, "heuristic"))
+				learn_method = LEARN_HEURISTIC;
+			else {
+				fprintf(stderr, _("Unknown fitting method %s\n"), optarg);
+				exit(1);
+			}
+			break;
 		case 'r':		/* html report */
 			reporttype = REPORT_HTML;
 			snprintf(filename, sizeof(filename), "%s", optarg ? optarg : "powertop.html");
@@ -492,6 +588,15 @@ int main(int argc, char **argv)
 				exit(1);
 			}
 			break;
+		case OPT_JSON:		/* JSON lines report */
+			reporttype = REPORT_JSON;
+			snprintf(filename, sizeof(filename), "%s", optarg ? optarg : "powertop.json");
+			if (!strlen(filename))
+			{
+				fprintf(stderr, _("Invalid JSON filename\n"));
+				exit(1);
+			}
+			break;
 		case 'i':
 			iterations = (optarg ? atoi(optarg) : 1);
 			break;
@@ -502,6 +607,28 @@ int main(int argc, char **argv)
 		case 's':
 			sample_interval = (optarg ? atoi(optarg) : 5);
 			break;
+		case OPT_STREAM:
+			perf_stream_mode = 1;
+			break;
+		case OPT_RAPL_RATE:
+			rapl_sample_rate = atoi(optarg);
+			if (rapl_sample_rate < 0)
+				rapl_sample_rate = 0;
+			if (rapl_sample_rate > 1000)
+				rapl_sample_rate = 1000;
+			break;
+		case OPT_RECORD:
+			if (trace_record_open(optarg)) {
+				fprintf(stderr, _("Cannot create %s\n"), optarg);
+				exit(1);
+			}
+			break;
+		case OPT_REPLAY:
+			if (trace_replay_open(optarg)) {
+				fprintf(stderr, _("Cannot read trace file %s\n"), optarg);
+				exit(1);
+			}
+			break;
 		case 't':
 			time_out = (optarg ? atoi(optarg) : 20);
 			break;
@@ -523,6 +650,11 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (trace_replaying() && reporttype == REPORT_OFF) {
+		fprintf(stderr, _("--replay needs a --csv, --html or --json report\n"));
+		exit(1);
+	}
+
 	powertop_init(auto_tune);
 
 	if (reporttype != REPORT_OFF)
@@ -28,6 +28,7 @@
 #include "sysfs.h"
 #include "opal-sensors.h"
 #include "../parameters/parameters.h"
+#include "../perf/perf_record.h"
 #include "../lib.h"
 
 #include <string>
@@ -169,8 +170,59 @@ void sysfs_opal_sensors_callback(const char *d_name)
 		power_meters.push_back(meter);
 }
 
+/* a meter of the recording machine, as it read at the end of a window */
+class recorded_power_meter: public power_meter {
+public:
+	double rate = 0.0;
+	double capacity = 0.0;
+
+	virtual double power(void) { return rate; };
+	virtual double dev_capacity(void) { return capacity; };
+};
+
+void save_power_meters(class trace_snapshot &snapshot)
+{
+	unsigned int i;
+
+	snapshot.put_u32(power_meters.size());
+	for (i = 0; i < power_meters.size(); i++) {
+		snapshot.put_u32(power_meters[i]->is_discharging());
+		snapshot.put_double(power_meters[i]->power());
+		snapshot.put_double(power_meters[i]->dev_capacity());
+	}
+}
+
+static vector<class recorded_power_meter *> recorded_meters;
+
+void load_power_meters(class trace_snapshot &snapshot)
+{
+	class recorded_power_meter *meter;
+	unsigned int i, count;
+
+	count = snapshot.get_u32();
+	for (i = 0; i < count && !snapshot.failed(); i++) {
+		if (i >= recorded_meters.size()) {
+			meter = new class recorded_power_meter;
+			recorded_meters.push_back(meter);
+			power_meters.push_back(meter);
+		}
+		meter = recorded_meters[i];
+		meter->set_discharging(snapshot.get_u32());
+		meter->rate = snapshot.get_double();
+		meter->capacity = snapshot.get_double();
+	}
+	/* a battery that went away no longer counts */
+	for (; i < recorded_meters.size(); i++) {
+		recorded_meters[i]->set_discharging(false);
+		recorded_meters[i]->rate = 0.0;
+	}
+}
+
 void detect_power_meters(void)
 {
+	if (trace_replaying())
+		return;
+
 	process_directory("/sys/class/power_supply", sysfs_power_meters_callback);
 	process_glob("/sys/devices/platform/opal-sensor/hwmon/hwmon*/power*", sysfs_opal_sensors_callback);
 	if (power_meters.size() == 0) {
@@ -64,6 +64,10 @@ extern double global_joules(void);
 extern double global_time_left(void);
 
 extern void detect_power_meters(void);
+
+class trace_snapshot;
+extern void save_power_meters(class trace_snapshot &snapshot);
+extern void load_power_meters(class trace_snapshot &snapshot);
 extern void extech_power_meter(const char *devnode);
 
 extern double min_power;
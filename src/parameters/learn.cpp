@@ -28,9 +28,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <sys/time.h>
+#include <algorithm>
 
 extern int debug_learning;
 
+int learn_method = LEARN_HEURISTIC;
+
 double calculate_params(struct parameter_bundle *params)
 {
 	unsigned int i;
@@ -72,44 +76,413 @@ static int try_zero(double value)
 
 static unsigned int previous_measurements;
 
-static void weed_empties(struct parameter_bundle *best_so_far)
+/*
+ * Every candidate the fit tries changes a single parameter, yet scoring it
+ * with calculate_params() re-evaluates every device against every past
+ * result. Keep the power each device contributes to each result, and which
+ * parameters each device model reads, so that a candidate only re-evaluates
+ * the devices that depend on the parameter it changes.
+ *
+ * Which parameters a model reads can depend on parameter values, but only
+ * on values it reads: when a parameter changes, re-tracing the devices
+ * that read it keeps the read sets exact.
+ */
+struct fit_state {
+	struct parameter_bundle		*params;
+	unsigned int			nr_devices;
+	unsigned int			nr_results;
+	vector<double>			contrib;	/* [device * nr_results + result] */
+	vector<double>			guess;		/* per result, summed over devices */
+	vector< vector<unsigned int> >	users;		/* per parameter, the devices reading it */
+	vector< vector<unsigned int> >	reads;		/* per device, the parameters it reads */
+	double				score;
+};
+
+struct fit_candidate {
+	unsigned int	param;
+	double		value;
+	double		score;
+};
+
+/*
+ * One parameter's turn in an iteration: grow it, then shrink it, where
+ * try_zero() may turn the shrink into a zero. Both possible shrink values
+ * are scored up front so the rand() draws can happen in the original order
+ * while walking the scores.
+ */
+struct fit_step {
+	unsigned int	param;
+	double		orgvalue;
+	double		shrunk;
+	int		grow;		/* index into candidates, or -1 */
+	int		shrink;
+	int		zero;
+};
+
+/* below this many device evaluations per iteration, score candidates inline */
+#define FIT_PARALLEL_MIN	20000
+
+struct fit_work {
+	struct fit_state	*fit;
+	struct fit_candidate	*candidates;
+};
+
+static double fit_score(struct fit_state *fit)
+{
+	double score = 0;
+	unsigned int s;
+
+	for (s = 0; s < fit->nr_results; s++) {
+		double actual = past_results[s]->power;
+
+		/* same weighting as compute_bundle() */
+		score += actual * (fit->guess[s] - actual) * (fit->guess[s] - actual);
+	}
+	return score;
+}
+
+/* recompute a device's contributions and record the parameters it reads */
+static void evaluate_device(struct fit_state *fit, unsigned int d)
+{
+	vector<unsigned int> &reads = fit->reads[d];
+	vector<unsigned char> traced;
+	vector<unsigned int>::iterator it;
+	unsigned int s, p;
+
+	traced.assign(fit->params->parameters.size(), 0);
+	trace_parameter_reads(&traced);
+	for (s = 0; s < fit->nr_results; s++) {
+		double *contrib = &fit->contrib[d * fit->nr_results + s];
+
+		fit->guess[s] -= *contrib;
+		*contrib = all_devices[d]->power_usage(past_results[s], fit->params);
+		fit->guess[s] += *contrib;
+	}
+	trace_parameter_reads(NULL);
+
+	/* users lists stay sorted by device */
+	for (p = 0; p < reads.size(); p++) {
+		vector<unsigned int> &users = fit->users[reads[p]];
+
+		it = lower_bound(users.begin(), users.end(), d);
+		if (it != users.end() && *it == d)
+			users.erase(it);
+	}
+	reads.clear();
+	for (p = 0; p < traced.size(); p++) {
+		if (!traced[p])
+			continue;
+		reads.push_back(p);
+		it = lower_bound(fit->users[p].begin(), fit->users[p].end(), d);
+		fit->users[p].insert(it, d);
+	}
+}
+
+/*
+ * Runs single threaded: the device models initialize their parameter and
+ * result indexes lazily on first use.
+ */
+static void build_fit(struct fit_state *fit, struct parameter_bundle *params)
+{
+	unsigned int d;
+
+	fit->params = params;
+	fit->nr_devices = all_devices.size();
+	fit->nr_results = past_results.size();
+	fit->contrib.assign(fit->nr_devices * fit->nr_results, 0.0);
+	fit->guess.assign(fit->nr_results, 0.0);
+	fit->users.assign(params->parameters.size(), vector<unsigned int>());
+	fit->reads.assign(fit->nr_devices, vector<unsigned int>());
+
+	for (d = 0; d < fit->nr_devices; d++)
+		evaluate_device(fit, d);
+	fit->score = fit_score(fit);
+}
+
+static double candidate_score(struct fit_state *fit, unsigned int param, double value)
+{
+	struct parameter_bundle trial;
+	vector<unsigned int> &users = fit->users[param];
+	double score = 0;
+	unsigned int s, u;
+
+	if (users.empty())
+		return fit->score;
+
+	trial.parameters = fit->params->parameters;
+	trial.parameters[param] = value;
+
+	for (s = 0; s < fit->nr_results; s++) {
+		double power = fit->guess[s];
+		double actual = past_results[s]->power;
+
+		for (u = 0; u < users.size(); u++) {
+			unsigned int d = users[u];
+
+			power -= fit->contrib[d * fit->nr_results + s];
+			power += all_devices[d]->power_usage(past_results[s], &trial);
+		}
+		score += actual * (power - actual) * (power - actual);
+	}
+	return score;
+}
+
+static void evaluate_candidate(unsigned int index, void *arg)
+{
+	struct fit_work *work = (struct fit_work *)arg;
+	struct fit_candidate *c = &work->candidates[index];
+
+	c->score = candidate_score(work->fit, c->param, c->value);
+}
+
+static void commit_parameter(struct fit_state *fit, unsigned int param, double value)
+{
+	vector<unsigned int> users = fit->users[param];	/* re-tracing edits the list */
+	unsigned int u;
+
+	fit->params->parameters[param] = value;
+
+	for (u = 0; u < users.size(); u++)
+		evaluate_device(fit, users[u]);
+	if (!users.empty())
+		fit->score = fit_score(fit);
+}
+
+static int add_candidate(vector<struct fit_candidate> &candidates, unsigned int param, double value)
+{
+	struct fit_candidate c;
+
+	c.param = param;
+	c.value = value;
+	c.score = 0;
+	candidates.push_back(c);
+	return candidates.size() - 1;
+}
+
+static void weed_empties(struct fit_state *fit)
 {
-	double best_score;
 	unsigned int i;
 
-	best_score = best_so_far->score;
+	for (i = 0; i < fit->params->parameters.size(); i++) {
+		if (fit->params->parameters[i] == 0.0)
+			continue;
+
+		if (candidate_score(fit, i, 0.0) <= fit->score)
+			commit_parameter(fit, i, 0.0);
+	}
+}
+
+/*
+ * Alternative fitting engine. Every device model is linear in its
+ * parameters, or close to it around the current values, so the fit is a
+ * weighted linear least squares problem with parameters in [0, 5000].
+ * Build the design matrix by probing each parameter once, form the normal
+ * equations and solve them with projected coordinate descent. The model is
+ * re-linearized a few times; a solution is only kept when it really scores
+ * better. No random moves, so the result is reproducible.
+ */
+#define NNLS_PASSES	3
+#define NNLS_SWEEPS	1000
+#define NNLS_MAX_VALUE	5000.0
+
+struct design {
+	struct fit_state	*fit;
+	vector<unsigned int>	params;		/* column -> parameter index */
+	unsigned int		stride;		/* nr_results padded to 4 */
+	unsigned int		gram_stride;	/* nr of columns padded to 4 */
+	vector<double>		columns;	/* [column * stride + result] */
+	vector<double>		gram;		/* columns' * columns, [column * gram_stride + column] */
+	vector<double>		rhs;		/* columns' * target */
+	vector<double>		target;
+};
 
+/*
+ * n is a multiple of 4 (rows are zero padded); four independent sums let
+ * the compiler keep them in vector registers.
+ */
+static double dot(const double *a, const double *b, unsigned int n)
+{
+	double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	unsigned int i;
 
-	for (i = 0; i < best_so_far->parameters.size(); i++) {
-		double orgvalue;
+	for (i = 0; i < n; i += 4) {
+		s0 += a[i] * b[i];
+		s1 += a[i + 1] * b[i + 1];
+		s2 += a[i + 2] * b[i + 2];
+		s3 += a[i + 3] * b[i + 3];
+	}
+	return (s0 + s1) + (s2 + s3);
+}
 
-		orgvalue = best_so_far->parameters[i];
+static void probe_column(unsigned int index, void *arg)
+{
+	struct design *dm = (struct design *)arg;
+	struct fit_state *fit = dm->fit;
+	struct parameter_bundle trial;
+	unsigned int param = dm->params[index];
+	vector<unsigned int> &users = fit->users[param];
+	double *column = &dm->columns[index * dm->stride];
+	unsigned int s, u;
 
+	trial.parameters = fit->params->parameters;
+	trial.parameters[param] += 1.0;
 
-		best_so_far->parameters[i] = 0.0;
+	for (s = 0; s < fit->nr_results; s++) {
+		double slope = 0;
 
-		calculate_params(best_so_far);
-		if (best_so_far->score > best_score) {
-				best_so_far->parameters[i] = orgvalue;
-		} else {
-			best_score = best_so_far->score;
+		for (u = 0; u < users.size(); u++) {
+			unsigned int d = users[u];
+
+			slope += all_devices[d]->power_usage(past_results[s], &trial);
+			slope -= fit->contrib[d * fit->nr_results + s];
 		}
+		column[s] = slope;
+	}
+}
 
+static void gram_row(unsigned int index, void *arg)
+{
+	struct design *dm = (struct design *)arg;
+	unsigned int n = dm->params.size();
+	const double *row = &dm->columns[index * dm->stride];
+	unsigned int k;
+
+	for (k = 0; k < n; k++)
+		dm->gram[index * dm->gram_stride + k] = dot(row, &dm->columns[k * dm->stride], dm->stride);
+	dm->rhs[index] = dot(row, &dm->target[0], dm->stride);
+}
+
+static void build_design(struct design *dm, struct fit_state *fit)
+{
+	unsigned int p, s, c, n;
+
+	dm->fit = fit;
+	dm->params.clear();
+	for (p = 0; p < fit->users.size(); p++)
+		if (!fit->users[p].empty())
+			dm->params.push_back(p);
+
+	n = dm->params.size();
+	dm->stride = (fit->nr_results + 3) & ~3U;
+	dm->columns.assign(n * dm->stride, 0.0);
+	dm->target.assign(dm->stride, 0.0);
+	dm->gram_stride = (n + 3) & ~3U;
+	dm->gram.assign(n * dm->gram_stride, 0.0);
+	dm->rhs.assign(n, 0.0);
+
+	if (n)
+		parallel_for(n, probe_column, dm);
+
+	/*
+	 * guess = offset + columns * parameters; fold the offset into the
+	 * target and weigh each row the way compute_bundle() does.
+	 */
+	for (s = 0; s < fit->nr_results; s++) {
+		double actual = past_results[s]->power;
+		double weight = actual > 0 ? sqrt(actual) : 0;
+		double offset = fit->guess[s];
+
+		for (c = 0; c < n; c++)
+			offset -= dm->columns[c * dm->stride + s] * fit->params->parameters[dm->params[c]];
+
+		dm->target[s] = weight * (actual - offset);
+		for (c = 0; c < n; c++)
+			dm->columns[c * dm->stride + s] *= weight;
 	}
-	calculate_params(best_so_far);
 
+	if (n)
+		parallel_for(n, gram_row, dm);
+}
+
+static void solve_nnls(struct design *dm, vector<double> &x)
+{
+	unsigned int n = dm->params.size();
+	unsigned int sweep, j;
+
+	for (sweep = 0; sweep < NNLS_SWEEPS; sweep++) {
+		double biggest = 0, step = 0;
+
+		for (j = 0; j < n; j++) {
+			const double *row = &dm->gram[j * dm->gram_stride];
+			double value;
+
+			if (row[j] <= 0)
+				continue;
+
+			value = x[j] - (dot(row, &x[0], dm->gram_stride) - dm->rhs[j]) / row[j];
+			if (value < 0)
+				value = 0;
+			if (value > NNLS_MAX_VALUE)
+				value = NNLS_MAX_VALUE;
+
+			if (fabs(value - x[j]) > step)
+				step = fabs(value - x[j]);
+			if (value > biggest)
+				biggest = value;
+			x[j] = value;
+		}
+		if (step <= 1e-7 * (1 + biggest))
+			break;
+	}
+}
+
+static void learn_nnls(struct parameter_bundle *params)
+{
+	struct fit_state fit;
+	struct design dm;
+	vector<double> x, saved;
+	unsigned int pass, c;
+	struct timeval start, end;
+
+	gettimeofday(&start, NULL);
+
+	build_fit(&fit, params);
+
+	for (pass = 0; pass < NNLS_PASSES; pass++) {
+		double before = fit.score;
+
+		build_design(&dm, &fit);
+		if (dm.params.empty())
+			break;
+
+		x.assign(dm.gram_stride, 0.0);
+		for (c = 0; c < dm.params.size(); c++)
+			x[c] = params->parameters[dm.params[c]];
+
+		solve_nnls(&dm, x);
+
+		saved = params->parameters;
+		for (c = 0; c < dm.params.size(); c++)
+			params->parameters[dm.params[c]] = x[c];
+		build_fit(&fit, params);
+
+		if (fit.score >= before) {
+			params->parameters = saved;
+			build_fit(&fit, params);
+			break;
+		}
+	}
+
+	gettimeofday(&end, NULL);
+	if (debug_learning)
+		printf("NNLS fit of %i parameters took %5.2f ms\n", (int)dm.params.size(),
+			(end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0);
 }
 
 /* leaks like a sieve */
 void learn_parameters(int iterations, int do_base_power)
 {
 	struct parameter_bundle *best_so_far;
+	struct fit_state fit;
+	struct fit_work work;
+	vector<struct fit_candidate> candidates;
+	vector<struct fit_step> steps;
 	double best_score = 10000000000000000.0;
 	int retry = iterations;
 	int prevparam = -1;
 	int locked = 0;
 	static unsigned int bpi = 0;
-	unsigned int i;
+	unsigned int i, evaluations;
 	time_t start;
 
 	/* don't start fitting anything until we have at least 1 more measurement than we have parameters */
@@ -133,8 +506,25 @@ void learn_parameters(int iterations, int do_base_power)
 	if (!bpi)
 		bpi = get_param_index("base power");
 
-	calculate_params(best_so_far);
-	best_score = best_so_far->score;
+	if (best_so_far->parameters[bpi] > min_power * 0.9)
+		best_so_far->parameters[bpi] = min_power * 0.9;
+
+	/* We want to give up a little of base power, to give other parameters room to change;
+	   base power is the end post for everything after all
+         */
+	if (do_base_power && !debug_learning)
+		best_so_far->parameters[bpi] *= 0.9998;
+
+	if (learn_method == LEARN_NNLS) {
+		learn_nnls(best_so_far);
+		calculate_params(best_so_far);
+		if (debug_learning)
+			printf("Final score %4.2f (%i points)\n", best_so_far->score / past_results.size(), (int)past_results.size());
+		return;
+	}
+
+	build_fit(&fit, best_so_far);
+	best_score = fit.score;
 
 	delta = 0.001 / pow(0.8, iterations / 2.0);
 	if (iterations < 25)
@@ -149,14 +539,7 @@ void learn_parameters(int iterations, int do_base_power)
 	if (debug_learning)
 		printf("Delta starts at %5.3f\n", delta);
 
-	if (best_so_far->parameters[bpi] > min_power * 0.9)
-		best_so_far->parameters[bpi] = min_power * 0.9;
-
-	/* We want to give up a little of base power, to give other parameters room to change;
-	   base power is the end post for everything after all
-         */
-	if (do_base_power && !debug_learning)
-		best_so_far->parameters[bpi] = best_so_far->parameters[bpi] * 0.9998;
+	work.fit = &fit;
 
 	start = time(NULL);
 
@@ -172,11 +555,25 @@ void learn_parameters(int iterations, int do_base_power)
 		if (time(NULL) - start > 1 && !debug_learning)
 			retry = 0;
 
-		calculate_params(best_so_far);
-		orgscore = best_score = best_so_far->score;
-
-
+		orgscore = best_score = fit.score;
+
+		/*
+		 * Scoring via compute_bundle() used to leave the guessed power of
+		 * the last result in the base power slot, which nothing reads
+		 * during the fit; keep starting each iteration from that value.
+		 */
+		best_so_far->parameters[bpi] = fit.guess[fit.nr_results - 1];
+
+		/*
+		 * Pick all candidate values up front, score them (in parallel
+		 * when there is enough work), then walk them in the order they
+		 * were tried in before, drawing from rand() as that did.
+		 */
+		candidates.clear();
+		steps.clear();
+		evaluations = 0;
 	        for (i = 1; i < best_so_far->parameters.size(); i++) {
+			struct fit_step step;
 			double value, orgvalue;
 
 			weight = delta * best_so_far->weights[i];
@@ -196,46 +593,64 @@ void learn_parameters(int iterations, int do_base_power)
 			if (value > 5000)
 				value = 5000;
 
-//			printf("Trying %s %4.2f -> %4.2f\n", param.c_str(), best_so_far->parameters[param], value);
-			best_so_far->parameters[i] = value;
-
-			calculate_params(best_so_far);
-			if (best_so_far->score < best_score || random_disturb(retry)) {
-				best_score = best_so_far->score;
-				newvalue = value;
-				bestparam = i;
-				changed++;
-			}
+			step.param = i;
+			step.orgvalue = orgvalue;
+			step.grow = add_candidate(candidates, i, value);
 
 			value = orgvalue * 1 / (1 + weight);
 
 			if (value < 0.0001)
 				value = 0.0;
 
-			if (try_zero(value))
-				value = 0.0;
-
-
 			if (value > 5000)
 				value = 5000;
 
+			step.shrunk = value;
+			step.shrink = step.zero = -1;
+			if (orgvalue != value)
+				step.shrink = add_candidate(candidates, i, value);
+			if (value != 0.0 && orgvalue != 0.0)
+				step.zero = add_candidate(candidates, i, 0.0);
+			steps.push_back(step);
 
-//			printf("Trying %s %4.2f -> %4.2f\n", param.c_str(), orgvalue, value);
+			evaluations += fit.users[i].size() * (candidates.size() - step.grow);
+		}
 
-			if (orgvalue != value) {
-				best_so_far->parameters[i] = value;
+		if (!candidates.empty()) {
+			work.candidates = &candidates[0];
+			if (evaluations * past_results.size() >= FIT_PARALLEL_MIN)
+				parallel_for(candidates.size(), evaluate_candidate, &work);
+			else
+				for (i = 0; i < candidates.size(); i++)
+					evaluate_candidate(i, &work);
+		}
 
-				calculate_params(best_so_far);
+		for (i = 0; i < steps.size(); i++) {
+			struct fit_step *step = &steps[i];
+			struct fit_candidate *c = &candidates[step->grow];
+			double value;
 
-				if (best_so_far->score + 0.00001 < best_score || (random_disturb(retry) && value > 0.0)) {
-					best_score = best_so_far->score;
-					newvalue = value;
-					bestparam = i;
-					changed++;
-				}
+//			printf("Trying %i %4.2f -> %4.2f\n", c->param, best_so_far->parameters[c->param], c->value);
+			if (c->score < best_score || random_disturb(retry)) {
+				best_score = c->score;
+				newvalue = c->value;
+				bestparam = c->param;
+				changed++;
 			}
-			best_so_far->parameters[i] = orgvalue;
 
+			value = step->shrunk;
+			if (try_zero(value))
+				value = 0.0;
+			if (value == step->orgvalue)
+				continue;
+
+			c = &candidates[value == step->shrunk ? step->shrink : step->zero];
+			if (c->score + 0.00001 < best_score || (random_disturb(retry) && c->value > 0.0)) {
+				best_score = c->score;
+				newvalue = c->value;
+				bestparam = c->param;
+				changed++;
+			}
 		}
 		if (!changed) {
 			double mult;
@@ -256,7 +671,7 @@ void learn_parameters(int iterations, int do_base_power)
 				printf("Changing score from %4.3f to %4.3f\n", orgscore, best_score);
 				printf("Changing value from %4.3f to %4.3f\n", best_so_far->parameters[bestparam], newvalue);
 			}
-			best_so_far->parameters[bestparam] = newvalue;
+			commit_parameter(&fit, bestparam, newvalue);
 			if (prevparam == bestparam)
 				delta = delta * 1.1;
 			prevparam = bestparam;
@@ -267,13 +682,16 @@ void learn_parameters(int iterations, int do_base_power)
 			break;
 
 		if (retry % 50 == 49)
-			weed_empties(best_so_far);
+			weed_empties(&fit);
 	}
 
 
 	/* now we weed out all parameters that don't have value */
 	if (iterations > 50)
-		weed_empties(best_so_far);
+		weed_empties(&fit);
+
+	/* refresh score, guessed power and base power the way the rest of powertop expects */
+	calculate_params(best_so_far);
 
 	if (debug_learning)
 		printf("Final score %4.2f (%i points)\n", best_so_far->score / past_results.size(), (int)past_results.size());
@@ -24,6 +24,7 @@
  */
 #include "parameters.h"
 #include "../measurement/measurement.h"
+#include "../perf/perf_record.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -31,6 +32,7 @@
 #include <vector>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
 
 
 struct parameter_bundle all_parameters;
@@ -38,6 +40,16 @@ struct result_bundle all_results;
 
 vector <struct result_bundle *> past_results;
 
+/*
+ * past_results points into a fixed pool of bundles. Once it is full, a new
+ * result replaces the oldest one outside the first MAX_PARAM - MAX_KEEP
+ * (which are kept for good), round robin. Replaced bundles are reused,
+ * utilization vector included, so the store stops allocating once every
+ * slot has been filled.
+ */
+static struct result_bundle result_store[MAX_PARAM];
+static unsigned int result_next = MAX_PARAM - MAX_KEEP;	/* next slot to replace */
+
 map <string, int> param_index;
 static int maxindex = 1;
 map <string, int> result_index;
@@ -114,12 +126,22 @@ double get_parameter_value(const char *name, struct parameter_bundle *the_bundle
 	return get_parameter_value(index, the_bundle);
 }
 
+/* set while the learning code works out which parameters a device model reads */
+static vector<unsigned char> *parameter_reads;
+
+void trace_parameter_reads(vector<unsigned char> *reads)
+{
+	parameter_reads = reads;
+}
+
 double get_parameter_value(unsigned int index, struct parameter_bundle *the_bundle)
 {
 	if (index >= the_bundle->parameters.size()) {
 		fprintf(stderr, "BUG: requesting unregistered parameter %d\n", index);
 		return 0;
 	}
+	if (parameter_reads && index < parameter_reads->size())
+		(*parameter_reads)[index] = 1;
 	return the_bundle->parameters[index];
 }
 
@@ -168,13 +190,20 @@ int result_device_exists(const char *name)
 	return 0;
 }
 
+/* devices report from the parallel end-of-measurement snapshot */
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void report_utilization(const char *name, double value, struct result_bundle *bundle)
 {
+	pthread_mutex_lock(&report_lock);
 	set_result_value(name, value, bundle);
+	pthread_mutex_unlock(&report_lock);
 }
 void report_utilization(int index, double value, struct result_bundle *bundle)
 {
+	pthread_mutex_lock(&report_lock);
 	set_result_value(index, value, bundle);
+	pthread_mutex_unlock(&report_lock);
 }
 
 
@@ -300,6 +329,46 @@ struct result_bundle * clone_results(struct result_bundle *bundle)
 	return b2;
 }
 
+/* indexes differ between runs, so utilizations are saved by name */
+void save_result_snapshot(class trace_snapshot &snapshot, struct result_bundle *bundle)
+{
+	map<string, int>::iterator it;
+	unsigned int count = 0;
+
+	for (it = result_index.begin(); it != result_index.end(); it++)
+		if (it->second < (int)bundle->utilization.size())
+			count++;
+
+	snapshot.put_double(bundle->joules);
+	snapshot.put_double(bundle->power);
+	snapshot.put_u32(count);
+	for (it = result_index.begin(); it != result_index.end(); it++) {
+		if (it->second >= (int)bundle->utilization.size())
+			continue;
+		snapshot.put_string(it->first.c_str());
+		snapshot.put_double(bundle->utilization[it->second]);
+	}
+}
+
+void load_result_snapshot(class trace_snapshot &snapshot, struct result_bundle *bundle)
+{
+	unsigned int i, count;
+	string name;
+	double value;
+
+	bundle->joules = snapshot.get_double();
+	bundle->power = snapshot.get_double();
+	bundle->utilization.assign(bundle->utilization.size(), 0.0);
+
+	count = snapshot.get_u32();
+	for (i = 0; i < count && !snapshot.failed(); i++) {
+		name = snapshot.get_string();
+		value = snapshot.get_double();
+		if (!snapshot.failed())
+			set_result_value(name.c_str(), value, bundle);
+	}
+}
+
 
 struct parameter_bundle * clone_parameters(struct parameter_bundle *bundle)
 {
@@ -323,22 +392,58 @@ struct parameter_bundle * clone_parameters(struct parameter_bundle *bundle)
 }
 
 
+/* returns an emptied bundle in past_results to store a new result in */
+struct result_bundle *add_past_result(unsigned int *slot)
+{
+	struct result_bundle *bundle;
+
+	if (past_results.size() < MAX_PARAM) {
+		*slot = past_results.size();
+		past_results.push_back(&result_store[*slot]);
+	} else {
+		*slot = result_next;
+		if (++result_next >= MAX_PARAM)
+			result_next = MAX_PARAM - MAX_KEEP;
+	}
+
+	bundle = past_results[*slot];
+	bundle->joules = 0;
+	bundle->power = 0;
+	bundle->utilization.clear();
+	return bundle;
+}
+
+/* the ring position is saved along with the results, so eviction order survives a restart */
+unsigned int next_result_slot(void)
+{
+	return result_next;
+}
+
+void set_next_result_slot(unsigned int slot)
+{
+	if (slot >= MAX_PARAM - MAX_KEEP && slot < MAX_PARAM)
+		result_next = slot;
+}
+
+void clear_past_results(void)
+{
+	past_results.clear();
+	result_next = MAX_PARAM - MAX_KEEP;
+}
+
 void store_results(double duration)
 {
 	if (duration < 5)
 		return;
 	global_power();
 	if (all_results.power > 0.01) {
-		unsigned int overflow_index;
-		overflow_index = 50 + (rand() % MAX_KEEP);
-		if (past_results.size() >= MAX_PARAM) {
-			/* memory leak, must free old one first */
-			past_results[overflow_index] = clone_results(&all_results);
-		} else {
-			past_results.push_back(clone_results(&all_results));
-		}
-		if ((past_results.size() % 10) == 0)
-			save_all_results("saved_results.powertop");
+		struct result_bundle *bundle;
+		unsigned int slot;
+
+		bundle = add_past_result(&slot);
+		bundle->power = all_results.power;
+		bundle->utilization = all_results.utilization;
+		save_result(slot, "saved_results.powertop");
 	}
 
 }
@@ -62,6 +62,7 @@ extern void register_parameter(const char *name, double default_value = 0.00, do
 extern double get_parameter_value(const char *name, struct parameter_bundle *bundle = &all_parameters);
 extern double get_parameter_value(unsigned int index, struct parameter_bundle *bundle = &all_parameters);
 extern void set_parameter_value(const char *name, double value, struct parameter_bundle *bundle = &all_parameters);
+extern void trace_parameter_reads(vector<unsigned char> *reads);
 
 
 struct result_bundle
@@ -74,6 +75,11 @@ struct result_bundle
 extern struct result_bundle all_results;
 extern vector <struct result_bundle *> past_results;
 
+extern struct result_bundle *add_past_result(unsigned int *slot);
+extern void clear_past_results(void);
+extern unsigned int next_result_slot(void);
+extern void set_next_result_slot(unsigned int slot);
+
 extern double get_result_value(const char *name, struct result_bundle *bundle = &all_results);
 extern double get_result_value(int index, struct result_bundle *bundle = &all_results);
 
@@ -95,12 +101,21 @@ void dump_parameter_bundle(struct parameter_bundle *patameters = &all_parameters
 void dump_result_bundle(struct result_bundle *res = &all_results);
 
 extern struct result_bundle * clone_results(struct result_bundle *bundle);
+
+class trace_snapshot;
+extern void save_result_snapshot(class trace_snapshot &snapshot, struct result_bundle *bundle = &all_results);
+extern void load_result_snapshot(class trace_snapshot &snapshot, struct result_bundle *bundle = &all_results);
 extern struct parameter_bundle * clone_parameters(struct parameter_bundle *bundle);
 
 extern void store_results(double duration);
 extern void learn_parameters(int iterations, int do_base_power);
+
+#define LEARN_HEURISTIC	0
+#define LEARN_NNLS	1
+extern int learn_method;
 extern char *get_param_directory(const char *filename);
 extern void save_all_results(const char *filename = "saved_results.powertop");
+extern void save_result(unsigned int slot, const char *filename = "saved_results.powertop");
 extern void close_results(void);
 extern void load_results(const char *filename);
 extern void save_parameters(const char *filename);
@@ -26,97 +26,185 @@
 #include <fstream>
 #include <iomanip>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "parameters.h"
 #include "../measurement/measurement.h"
 
 using namespace std;
 
+/*
+ * saved_results.powertop is a binary file: a header, the names of the
+ * result columns, then one fixed width row of doubles per entry of
+ * past_results, in the same order (row = power, then one value per
+ * column). Row i mirrors past_results[i], so storing a new result is a
+ * single pwrite of its row; the file is only rewritten when a result
+ * name appears that has no column yet. Older text files are still read.
+ */
+#define RESULTS_MAGIC	"PTRESLT"
+#define RESULTS_VERSION	1
+
+struct results_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	nr_columns;
+	uint32_t	data_offset;	/* start of the rows, 8 byte aligned */
+	uint32_t	next_slot;	/* where past_results replaces its next entry */
+};
+
+static int results_fd = -1;
+static vector<int> results_columns;	/* column -> result index */
+static uint32_t results_data_offset;
+static unsigned int results_rows;
+
+static void fill_row(vector<double> &row, struct result_bundle *bundle)
+{
+	unsigned int c;
+
+	row.resize(results_columns.size() + 1);
+	row[0] = bundle->power;
+	for (c = 0; c < results_columns.size(); c++)
+		row[c + 1] = get_result_value(results_columns[c], bundle);
+}
+
 void save_all_results(const char *filename)
 {
-	ofstream file;
+	struct results_header header;
+	map<string, int>::iterator it;
+	vector<double> rows, row;
+	string names;
 	unsigned int i;
-	struct result_bundle *bundle;
 	char* pathname;
+	int fd;
 
 	pathname = get_param_directory(filename);
 
-	file.open(pathname, ios::out);
-	if (!file) {
+	if (results_fd >= 0)
+		close(results_fd);
+	results_fd = -1;
+
+	fd = open(pathname, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
 		cout << _("Cannot save to file") << " " << pathname << "\n";
 		return;
 	}
+
+	results_columns.clear();
+	for (it = result_index.begin(); it != result_index.end(); it++) {
+		results_columns.push_back(it->second);
+		names += it->first;
+		names += '\0';
+	}
+	names.resize((sizeof(header) + names.size() + 7) / 8 * 8 - sizeof(header), '\0');
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RESULTS_MAGIC, sizeof(header.magic));
+	header.version = RESULTS_VERSION;
+	header.nr_columns = results_columns.size();
+	header.data_offset = sizeof(header) + names.size();
+	header.next_slot = next_result_slot();
+
 	for (i = 0; i < past_results.size(); i++) {
-		bundle = past_results[i];
-		map<string, int>::iterator it;
-		file << setiosflags(ios::fixed) <<  setprecision(5) << bundle->power << "\n";
+		fill_row(row, past_results[i]);
+		rows.insert(rows.end(), row.begin(), row.end());
+	}
 
-		for (it = result_index.begin(); it != result_index.end(); it++) {
-			file << it->first << "\t" << setprecision(5) << get_result_value(it->second, bundle) << "\n";
-		}
-		file << ":\n";
+	if (write(fd, &header, sizeof(header)) != sizeof(header) ||
+	    write(fd, names.data(), names.size()) != (ssize_t)names.size() ||
+	    write(fd, rows.data(), rows.size() * sizeof(double)) != (ssize_t)(rows.size() * sizeof(double))) {
+		cout << _("Cannot save to file") << " " << pathname << "\n";
+		close(fd);
+		return;
 	}
 
-	file.close();
+	results_fd = fd;
+	results_data_offset = header.data_offset;
+	results_rows = past_results.size();
+}
+
+/* write out past_results[slot] after it was added or replaced */
+void save_result(unsigned int slot, const char *filename)
+{
+	vector<double> row;
+	size_t size;
+
+	if (results_fd < 0 || result_index.size() != results_columns.size() || slot > results_rows) {
+		save_all_results(filename);
+		return;
+	}
+
+	fill_row(row, past_results[slot]);
+	size = row.size() * sizeof(double);
+	if (pwrite(results_fd, row.data(), size, results_data_offset + (off_t)slot * size) != (ssize_t)size) {
+		save_all_results(filename);
+		return;
+	}
+	if (slot == results_rows)
+		results_rows++;
 
+	slot = next_result_slot();
+	if (pwrite(results_fd, &slot, sizeof(slot), offsetof(struct results_header, next_slot)) != sizeof(slot))
+		save_all_results(filename);
 }
 
 void close_results()
 {
-	for (unsigned int i = 0; i < past_results.size(); i++) {
-		delete past_results[i];
-	}
+	clear_past_results();
 
-	past_results.clear();
+	if (results_fd >= 0)
+		close(results_fd);
+	results_fd = -1;
 	return;
 }
 
-void load_results(const char *filename)
+static void add_loaded_result(const struct result_bundle *loaded)
+{
+	struct result_bundle *bundle;
+	unsigned int slot;
+
+	bundle = add_past_result(&slot);
+	bundle->power = loaded->power;
+	bundle->utilization = loaded->utilization;
+}
+
+static int load_text_results(const char *pathname)
 {
 	ifstream file;
 	char line[4096];
 	char *c1;
-	struct result_bundle *bundle;
+	struct result_bundle bundle;
 	int first = 1;
 	unsigned int count = 0;
-	char* pathname;
-	int bundle_saved = 0;
-
-	pathname = get_param_directory(filename);
 
 	file.open(pathname, ios::in);
-	if (!file) {
-		cout << _("Cannot load from file") << " " << pathname << "\n";
-		return;
-	}
+	if (!file)
+		return -1;
 
-	bundle = new struct result_bundle;
+	bundle.power = 0;
 
 	while (file) {
 		double d;
 		if (first) {
 			file.getline(line, 4096);
 			if (strlen(line)>0) {
-				sscanf(line, "%lf", &bundle->power);
-				if (bundle->power < min_power)
-					min_power = bundle->power;
+				sscanf(line, "%lf", &bundle.power);
+				if (bundle.power < min_power)
+					min_power = bundle.power;
 			}
 			first = 0;
 			continue;
 		}
 		file.getline(line, 4096);
 		if (strlen(line) < 3) {
-			int overflow_index;
-
-			bundle_saved = 1;
-			overflow_index = 50 + (rand() % MAX_KEEP);
-			if (past_results.size() >= MAX_PARAM) {
-			/* memory leak, must free old one first */
-				past_results[overflow_index] = bundle;
-			} else {
-				past_results.push_back(bundle);
-			}
-			bundle = new struct result_bundle;
+			add_loaded_result(&bundle);
+			bundle.power = 0;
+			bundle.utilization.clear();
 			first = 1;
 			count++;
 			continue;
@@ -127,13 +215,118 @@ void load_results(const char *filename)
 		*c1 = 0;
 		c1++;
 		sscanf(c1, "%lf", &d);
-		set_result_value(line, d, bundle);
+		set_result_value(line, d, &bundle);
 	}
 
-	if (bundle_saved == 0)
-		delete bundle;
-
 	file.close();
+	return count;
+}
+
+/* returns the number of rows loaded, or -1 if this isn't a binary results file */
+static int load_binary_results(int fd, size_t size)
+{
+	struct results_header *header;
+	struct result_bundle *bundle;
+	const char *name, *names_end;
+	const double *row;
+	unsigned int nr_rows, r, c, slot;
+	int max_index = 0;
+	void *map;
+
+	if (size < sizeof(*header))
+		return -1;
+
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+
+	header = (struct results_header *)map;
+	if (memcmp(header->magic, RESULTS_MAGIC, sizeof(header->magic)) ||
+	    header->version != RESULTS_VERSION ||
+	    header->data_offset < sizeof(*header) || header->data_offset > size ||
+	    header->data_offset % 8) {
+		munmap(map, size);
+		return -1;
+	}
+
+	results_columns.clear();
+	name = (const char *)map + sizeof(*header);
+	names_end = (const char *)map + header->data_offset;
+	for (c = 0; c < header->nr_columns; c++) {
+		size_t len = strnlen(name, names_end - name);
+
+		if (name + len >= names_end)
+			break;
+		results_columns.push_back(get_result_index(name));
+		if (results_columns.back() > max_index)
+			max_index = results_columns.back();
+		name += len + 1;
+	}
+	if (c < header->nr_columns) {
+		results_columns.clear();
+		munmap(map, size);
+		return -1;
+	}
+
+	/* a partially written last row is dropped */
+	nr_rows = (size - header->data_offset) / ((header->nr_columns + 1) * sizeof(double));
+	row = (const double *)((const char *)map + header->data_offset);
+
+	for (r = 0; r < nr_rows; r++) {
+		bundle = add_past_result(&slot);
+		bundle->power = row[0];
+		if (bundle->power < min_power)
+			min_power = bundle->power;
+		bundle->utilization.resize(max_index + 1, 0.0);
+		for (c = 0; c < header->nr_columns; c++)
+			bundle->utilization[results_columns[c]] = row[c + 1];
+		row += header->nr_columns + 1;
+	}
+
+	set_next_result_slot(header->next_slot);
+	results_data_offset = header->data_offset;
+	results_rows = nr_rows;
+
+	munmap(map, size);
+	return nr_rows;
+}
+
+void load_results(const char *filename)
+{
+	struct stat st;
+	char* pathname;
+	int count;
+	int fd;
+
+	pathname = get_param_directory(filename);
+
+	fd = open(pathname, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		fd = open(pathname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st)) {
+		if (fd >= 0)
+			close(fd);
+		cout << _("Cannot load from file") << " " << pathname << "\n";
+		return;
+	}
+
+	count = load_binary_results(fd, st.st_size);
+	if (count >= 0 && results_rows == past_results.size()) {
+		/* rows still mirror past_results, keep the file open for appending */
+		results_fd = fd;
+	} else {
+		close(fd);
+		if (count < 0)
+			count = load_text_results(pathname);
+		/* the next store writes the whole file out */
+		results_columns.clear();
+	}
+
+	if (count < 0) {
+		cout << _("Cannot load from file") << " " << pathname << "\n";
+		return;
+	}
+
 	// '%i" is for count, do not translate
 	fprintf(stderr, _("Loaded %i prior measurements\n"), count);
 }
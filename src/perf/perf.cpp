@@ -89,6 +89,13 @@ void perf_event::create_perf_event(char *eventname, int _cpu)
 	attr.type		= PERF_TYPE_TRACEPOINT;
 	attr.config		= trace_type;
 
+	/* streaming mode: wake the reader up well before the ring overflows */
+	if (wakeup_watermark) {
+		attr.watermark		= 1;
+		attr.wakeup_watermark	= wakeup_watermark;
+	}
+	lost = 0;
+
 	if (attr.config <= 0)
 		return;
 
@@ -167,6 +174,7 @@ void perf_event::set_event_name(const char *system_name, const char *event_name)
 perf_event::~perf_event(void)
 {
 	free(name);
+	free(wrap_buffer);
 
 	if (tep_get_ref(perf_event::tep) == 1) {
 		tep_free(perf_event::tep);
@@ -197,6 +205,9 @@ perf_event::perf_event(const char *system_name, const char *event_name, int _cpu
 	bufsize = buffer_size;
 	cpu = _cpu;
 	perf_mmap = NULL;
+	wrap_buffer = NULL;
+	wakeup_watermark = 0;
+	lost = 0;
 	trace_type = 0;
 	set_event_name(system_name, event_name);
 }
@@ -208,6 +219,9 @@ perf_event::perf_event(void)
 	perf_fd = -1;
 	bufsize = 128;
 	perf_mmap = NULL;
+	wrap_buffer = NULL;
+	wakeup_watermark = 0;
+	lost = 0;
 	cpu = 0;
 	trace_type = 0;
 }
@@ -225,31 +239,70 @@ void perf_event::stop(void)
 		cout << "stop failing\n";
 }
 
+struct lost_event {
+	struct perf_event_header	header;
+	uint64_t			id;
+	uint64_t			lost;
+};
+
+/*
+ * Consume everything between data_tail and data_head. This is safe to
+ * call while the event is enabled: data_head is read once (with the
+ * barrier the perf ABI asks for) and data_tail only published at the end.
+ */
 void perf_event::process(void *cookie)
 {
 	struct perf_event_header *header;
+	uint64_t head, tail;
+	unsigned int size;
+	unsigned int offset;
 
-	if (perf_fd < 0)
+	if (perf_fd < 0 || !perf_mmap)
 		return;
 
-	while (pc->data_tail != pc->data_head ) {
-		while (pc->data_tail >= (unsigned int)bufsize * getpagesize())
-			pc->data_tail -= bufsize * getpagesize();
+	size = ring_size();
 
-		header = (struct perf_event_header *)( (unsigned char *)data_mmap + pc->data_tail);
+	head = pc->data_head;
+	__sync_synchronize();
+	tail = pc->data_tail;
+
+	while (tail < head) {
+		offset = tail % size;
+		header = (struct perf_event_header *)( (unsigned char *)data_mmap + offset);
 
 		if (header->size == 0)
 			break;
 
-		pc->data_tail += header->size;
-
-		while (pc->data_tail >= (unsigned int)bufsize * getpagesize())
-			pc->data_tail -= bufsize * getpagesize();
+		tail += header->size;
+
+		if (header->type != PERF_RECORD_SAMPLE && header->type != PERF_RECORD_LOST)
+			continue;
+
+		/*
+		 * Records are 8 byte aligned so the header itself never wraps,
+		 * but the payload can; hand out a linear copy in that case so
+		 * consumers can always reference the record in place.
+		 */
+		if (offset + header->size > size) {
+			unsigned int first = size - offset;
+
+			if (!wrap_buffer)
+				wrap_buffer = (unsigned char *)malloc(65536);
+			if (!wrap_buffer)
+				continue;
+			memcpy(wrap_buffer, header, first);
+			memcpy(wrap_buffer + first, data_mmap, header->size - first);
+			header = (struct perf_event_header *)wrap_buffer;
+		}
 
-		if (header->type == PERF_RECORD_SAMPLE)
+		if (header->type == PERF_RECORD_LOST)
+			lost += ((struct lost_event *)header)->lost;
+		else
 			handle_event(header, cookie);
 	}
-	pc->data_tail = pc->data_head;
+
+	__sync_synchronize();
+	pc->data_tail = tail;
 }
 
 void perf_event::clear(void)
@@ -26,6 +26,8 @@
 #define _INCLUDE_GUARD_PERF_H_
 
 #include <iostream>
+#include <unistd.h>
+#include <stdint.h>
 
 
 extern "C" {
@@ -47,10 +49,13 @@ protected:
 	int bufsize;
 	char *name;
 	int cpu;
+	unsigned char *wrap_buffer;
+	unsigned int wakeup_watermark;
 	void create_perf_event(char *eventname, int cpu);
 
 public:
 	unsigned int trace_type;
+	uint64_t lost;
 
 	perf_event(void);
 	perf_event(const char *system_name, const char *event_name, int cpu = 0, int buffer_size = 128);
@@ -60,6 +65,9 @@ public:
 
 	void set_event_name(const char *system_name, const char *event_name);
 	void set_cpu(int cpu);
+	void set_wakeup_watermark(unsigned int bytes) { wakeup_watermark = bytes; };
+	int fd(void) const { return perf_fd; };
+	unsigned int ring_size(void) const { return (unsigned int)bufsize * getpagesize(); };
 
 	void start(void);
 	void stop(void);
@@ -67,6 +75,12 @@ public:
 
 	void process(void *cookie);
 
+	/* true if the record lives in this event's mmap ring (as opposed to a linearized copy) */
+	bool in_ring(const void *record) const {
+		return perf_mmap && record >= data_mmap &&
+			record < (unsigned char *)data_mmap + (size_t)bufsize * getpagesize();
+	}
+
 	virtual void handle_event(struct perf_event_header *header, void *cookie) { };
 
 	static struct tep_handle *tep;
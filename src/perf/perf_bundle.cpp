@@ -32,20 +32,94 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <sys/epoll.h>
 
 #include "perf_bundle.h"
 #include "perf_event.h"
 #include "perf.h"
+#include "perf_record.h"
 
 #include "../cpu/cpu.h"
 
-#if defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus >= 201103L)
-# define USE_DECLTYPE
-#endif
+#define ARENA_CHUNK_SIZE	(256 * 1024)
+
+/*
+ * Records the streaming reader copies out of the rings stay in the arena
+ * until the window is processed; past 64 MiB they are dropped and counted
+ * as lost instead of growing without bound on a busy system.
+ */
+#define ARENA_MAX_CHUNKS	256
+
+
+record_arena::record_arena(void)
+{
+	current = 0;
+	used = 0;
+}
+
+record_arena::~record_arena(void)
+{
+	release();
+}
+
+void *record_arena::alloc(size_t size)
+{
+	unsigned char *ptr;
+
+	/* keep records 8 byte aligned, like they are in the ring */
+	size = (size + 7) & ~((size_t)7);
+	if (size > ARENA_CHUNK_SIZE)
+		return NULL;
+
+	if (current < chunks.size() && used + size > ARENA_CHUNK_SIZE) {
+		current++;
+		used = 0;
+	}
+
+	if (current >= chunks.size()) {
+		if (chunks.size() >= ARENA_MAX_CHUNKS)
+			return NULL;
+		ptr = (unsigned char *)malloc(ARENA_CHUNK_SIZE);
+		if (!ptr)
+			return NULL;
+		chunks.push_back(ptr);
+		current = chunks.size() - 1;
+		used = 0;
+	}
+
+	ptr = chunks[current] + used;
+	used += size;
+	return ptr;
+}
+
+void record_arena::reset(void)
+{
+	current = 0;
+	used = 0;
+}
+
+void record_arena::release(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < chunks.size(); i++)
+		free(chunks[i]);
+	chunks.clear();
+	reset();
+}
+
+int perf_stream_mode;
+
+
+static unsigned int nr_bundles;
+static vector<class perf_bundle *> all_bundles;
 
 class perf_bundle_event: public perf_event
 {
 public:
+	vector<void *> records;
+
 	perf_bundle_event(void);
 	virtual void handle_event(struct perf_event_header *header, void *cookie);
 };
@@ -55,28 +129,70 @@ perf_bundle_event::perf_bundle_event(void) : perf_event()
 }
 
 
+/*
+ * Once the event is stopped the ring stays mapped until perf_bundle::clear(),
+ * so samples are referenced in place. Records that were linearized because
+ * they wrapped around the ring, and everything drained by the streaming
+ * reader while the kernel may still reuse the space, are copied.
+ */
 void perf_bundle_event::handle_event(struct perf_event_header *header, void *cookie)
 {
-	unsigned char *buffer;
-	vector<void *> *vector;
+	class perf_bundle *bundle;
+	void *record;
 
-	buffer = (unsigned char *)malloc(header->size);
-	memcpy(buffer, header, header->size);
+	bundle = (class perf_bundle *)cookie;
 
-#ifdef USE_DECLTYPE
-	vector = (decltype(vector))cookie;
-#else
-	vector = (typeof(vector))cookie;
-#endif
-	vector->push_back(buffer);
+	if (!bundle->streaming && in_ring(header)) {
+		records.push_back(header);
+		return;
+	}
+
+	record = bundle->arena.alloc(header->size);
+	if (!record) {
+		lost++;
+		return;
+	}
+	memcpy(record, header, header->size);
+	records.push_back(record);
+}
+
+
+perf_bundle::perf_bundle(void)
+{
+	id = nr_bundles++;
+	trace_points = NULL;
+	streaming = false;
+	stream_stop = false;
+	epoll_fd = -1;
+	all_bundles.push_back(this);
+}
+
+perf_bundle::perf_bundle(const struct trace_point_desc *points)
+{
+	id = nr_bundles++;
+	trace_points = points;
+	streaming = false;
+	stream_stop = false;
+	epoll_fd = -1;
+	all_bundles.push_back(this);
 }
 
+perf_bundle::~perf_bundle()
+{
+	vector<class perf_bundle *>::iterator it;
+
+	it = find(all_bundles.begin(), all_bundles.end(), this);
+	if (it != all_bundles.end())
+		all_bundles.erase(it);
+}
 
 void perf_bundle::release(void)
 {
 	class perf_event *ev;
 	unsigned int i = 0;
 
+	stop_streaming();
+
 	for (i = 0; i < events.size(); i++) {
 		ev = events[i];
 		if (!ev)
@@ -85,11 +201,43 @@ void perf_bundle::release(void)
 		delete ev;
 	}
 	events.clear();
+	dispatch.clear();
+
+	arena.release();
+}
+
+/*
+ * Resolve the handler and the field descriptors for one tracepoint id, so
+ * that per-sample dispatch is an array index plus direct field loads.
+ */
+void perf_bundle::add_dispatch(unsigned int trace_type)
+{
+	struct trace_dispatch *d;
+	const struct trace_point_desc *desc;
+	struct tep_event *event;
+	int i;
+
+	event = tep_find_event(perf_event::tep, trace_type);
+	if (!event)
+		return;
+
+	if (dispatch.size() <= trace_type)
+		dispatch.resize(trace_type + 1);
 
-	for(i = 0; i < records.size(); i++) {
-		free(records[i]);
+	d = &dispatch[trace_type];
+	memset(d, 0, sizeof(*d));
+	d->event = event;
+	d->cpu_id = tep_find_field(event, "cpu_id");
+
+	for (desc = trace_points; desc && desc->name; desc++) {
+		if (strcmp(desc->name, event->name))
+			continue;
+
+		d->handler = desc->handler;
+		for (i = 0; i < TRACE_MAX_FIELDS && desc->fields[i]; i++)
+			d->fields[i] = tep_find_any_field(event, desc->fields[i]);
+		break;
 	}
-	records.clear();
 }
 
 bool perf_bundle::add_event(const char *system_name, const char *event_name)
@@ -97,7 +245,16 @@ bool perf_bundle::add_event(const char *system_name, const char *event_name)
 	unsigned int i;
 	int event_added = false;
 	class perf_event *ev;
+	int type;
 
+	/* no kernel events when replaying, only the recorded formats */
+	if (trace_replaying()) {
+		type = replay_format(system_name, event_name);
+		if (type < 0)
+			return false;
+		add_dispatch(type);
+		return true;
+	}
 
 	for (i = 0; i < all_cpus.size(); i++) {
 
@@ -110,15 +267,104 @@ bool perf_bundle::add_event(const char *system_name, const char *event_name)
 		ev->set_cpu(i);
 
 		if ((int)ev->trace_type >= 0) {
+			if (!event_added)
+				add_dispatch(ev->trace_type);
 			events.push_back(ev);
 			event_added = true;
 		} else {
 			delete ev;
 		}
 	}
+	if (event_added)
+		record_format(system_name, event_name);
 	return event_added;
 }
 
+int trace_field_val(struct trace_dispatch *d, int field, void *trace, unsigned long long *val)
+{
+	if (!d->fields[field])
+		return -1;
+	if (tep_read_number_field(d->fields[field], trace, val))
+		return -1;
+	return 0;
+}
+
+struct trace_dispatch *perf_bundle::find_dispatch(void *trace)
+{
+	struct tep_record rec; /* holder */
+	unsigned int type;
+
+	rec.data = trace;
+	type = tep_data_type(perf_event::tep, &rec);
+
+	if (type >= dispatch.size() || !dispatch[type].event)
+		return NULL;
+	return &dispatch[type];
+}
+
+/*
+ * Streaming mode: a reader thread waits on all perf fds and drains a ring
+ * as soon as it crosses its wakeup watermark, so long windows on busy
+ * systems don't overrun the rings. Records are only collected here; they
+ * are still merged and handed to the bundle in process().
+ */
+static void *perf_stream_thread(void *arg)
+{
+	class perf_bundle *bundle = (class perf_bundle *)arg;
+	struct epoll_event ready[64];
+	int i, n;
+
+	while (!bundle->stream_stop) {
+		n = epoll_wait(bundle->epoll_fd, ready, 64, 100);
+		for (i = 0; i < n; i++)
+			((class perf_event *)ready[i].data.ptr)->process(bundle);
+	}
+	return NULL;
+}
+
+void perf_bundle::start_streaming(void)
+{
+	struct epoll_event ee;
+	unsigned int i;
+	class perf_event *ev;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+		return;
+
+	for (i = 0; i < events.size(); i++) {
+		ev = events[i];
+		if (!ev || ev->fd() < 0)
+			continue;
+		memset(&ee, 0, sizeof(ee));
+		ee.events = EPOLLIN;
+		ee.data.ptr = ev;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev->fd(), &ee);
+	}
+
+	stream_stop = false;
+	streaming = true;
+	if (pthread_create(&stream_thread, NULL, perf_stream_thread, this)) {
+		fprintf(stderr, "perf streaming thread creation failed\n");
+		streaming = false;
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+}
+
+void perf_bundle::stop_streaming(void)
+{
+	if (!streaming)
+		return;
+
+	stream_stop = true;
+	pthread_join(stream_thread, NULL);
+	streaming = false;
+
+	close(epoll_fd);
+	epoll_fd = -1;
+}
+
 void perf_bundle::start(void)
 {
 	unsigned int i;
@@ -128,14 +374,20 @@ void perf_bundle::start(void)
 		ev = events[i];
 		if (!ev)
 			continue;
+		ev->set_wakeup_watermark(perf_stream_mode ? ev->ring_size() / 4 : 0);
 		ev->start();
 	}
+
+	if (perf_stream_mode)
+		start_streaming();
 }
 void perf_bundle::stop(void)
 {
 	unsigned int i;
 	class perf_event *ev;
 
+	stop_streaming();
+
 	for (i = 0; i < events.size(); i++) {
 		ev = events[i];
 		if (!ev)
@@ -147,19 +399,39 @@ void perf_bundle::clear(void)
 {
 	unsigned int i;
 
-	class perf_event *ev;
+	class perf_bundle_event *ev;
 
 	for (i = 0; i < events.size(); i++) {
-		ev = events[i];
+		ev = (class perf_bundle_event *)events[i];
 		if (!ev)
 			continue;
 		ev->clear();
+		ev->records.resize(0);
 	}
 
-	for (i = 0; i < records.size(); i++) {
-		free(records[i]);
-	}
-	records.resize(0);
+	arena.reset();
+}
+
+uint64_t perf_bundle::lost_records(void)
+{
+	unsigned int i;
+	uint64_t total = 0;
+
+	for (i = 0; i < events.size(); i++)
+		if (events[i])
+			total += events[i]->lost;
+	return total;
+}
+
+/* records lost by any bundle since its events were last started */
+uint64_t perf_lost_records(void)
+{
+	unsigned int i;
+	uint64_t total = 0;
+
+	for (i = 0; i < all_bundles.size(); i++)
+		total += all_bundles[i]->lost_records();
+	return total;
 }
 
 
@@ -214,13 +486,17 @@ static uint64_t timestamp(perf_event_header *event)
 
 }
 
-static bool event_sort_function (void *i, void *j)
+static bool record_key_sort(const struct record_key &i, const struct record_key &j)
 {
-	struct perf_event_header *I, *J;
+	return i.time < j.time;
+}
 
-	I = (struct perf_event_header *) i;
-	J = (struct perf_event_header *) j;
-	return (timestamp(I)<timestamp(J));
+/* heap comparator: the earliest record ends up on top, ties go to the lower run */
+static bool record_key_later(const struct record_key &i, const struct record_key &j)
+{
+	if (i.time != j.time)
+		return i.time > j.time;
+	return i.run > j.run;
 }
 
 /*
@@ -228,51 +504,91 @@ static bool event_sort_function (void *i, void *j)
  * time of perf_event_output(), which may differ from struct perf_event
  * cpu, thus we need to fix sample->trace.cpu.
  */
-static void fixup_sample_trace_cpu(struct perf_sample *sample)
+static void fixup_sample_trace_cpu(struct perf_sample *sample, struct trace_dispatch *d)
 {
-	struct tep_event *event;
-	struct tep_record rec;
 	unsigned long long cpu_nr;
-	int type;
-	int ret;
 
-	rec.data = &sample->data;
-	type = tep_data_type(perf_event::tep, &rec);
-	event = tep_find_event(perf_event::tep, type);
-	if (!event)
-		return;
 	/** don't touch trace if event does not contain cpu_id field*/
-	ret = tep_get_field_val(NULL, event, "cpu_id", &rec, &cpu_nr, 0);
-	if (ret < 0)
+	if (!d || !d->cpu_id)
+		return;
+	if (tep_read_number_field(d->cpu_id, &sample->data, &cpu_nr))
 		return;
 	sample->trace.cpu = cpu_nr;
 }
 
+/*
+ * Every perf_event ring is already in time order, so instead of sorting
+ * all records we do a k-way merge over the per-ring runs. Timestamps are
+ * extracted once into the key array; the heap holds one key per run.
+ */
 void perf_bundle::process(void)
 {
-	unsigned int i;
-	class perf_event *ev;
+	unsigned int i, j, start;
+	class perf_bundle_event *ev;
+	struct record_key key;
+
+	runs.resize(0);
+	keys.resize(0);
+
+	if (trace_replaying() && replay_window(id, runs, keys))
+		for (i = 0; i < keys.size(); i++)
+			keys[i].time = timestamp((struct perf_event_header *)keys[i].record);
 
-	/* fixme: reserve enough space in the array in one go */
 	for (i = 0; i < events.size(); i++) {
-		ev = events[i];
+		ev = (class perf_bundle_event *)events[i];
 		if (!ev)
 			continue;
-		ev->process(&records);
+		ev->process(this);
+		if (ev->records.empty())
+			continue;
+
+		start = keys.size();
+		keys.resize(start + ev->records.size());
+		for (j = 0; j < ev->records.size(); j++) {
+			keys[start + j].time = timestamp((struct perf_event_header *)ev->records[j]);
+			keys[start + j].run = runs.size();
+			keys[start + j].record = ev->records[j];
+		}
+		runs.push_back(start);
 	}
-	sort(records.begin(), records.end(), event_sort_function);
+	runs.push_back(keys.size());
+
+	if (trace_recording())
+		record_window(id, runs, keys);
+
+	for (i = 0; i + 1 < runs.size(); i++) {
+		/* a ring should never go backwards in time, but don't rely on it */
+		if (!is_sorted(keys.begin() + runs[i], keys.begin() + runs[i + 1], record_key_sort))
+			stable_sort(keys.begin() + runs[i], keys.begin() + runs[i + 1], record_key_sort);
+		for (j = runs[i]; j < runs[i + 1]; j++)
+			keys[j].index = j;
+	}
+
+	heap.resize(0);
+	for (i = 0; i + 1 < runs.size(); i++)
+		heap.push_back(keys[runs[i]]);
+	make_heap(heap.begin(), heap.end(), record_key_later);
 
-	for (i = 0; i < records.size(); i++) {
+	while (!heap.empty()) {
 		struct perf_sample *sample;
 
-		sample = (struct perf_sample *)records[i];
-		if (!sample)
-			continue;
+		pop_heap(heap.begin(), heap.end(), record_key_later);
+		key = heap.back();
+		heap.pop_back();
+
+		if (key.index + 1 < runs[key.run + 1]) {
+			heap.push_back(keys[key.index + 1]);
+			push_heap(heap.begin(), heap.end(), record_key_later);
+		}
 
+		sample = (struct perf_sample *)key.record;
 		if (sample->header.type != PERF_RECORD_SAMPLE)
 			continue;
 
-		fixup_sample_trace_cpu(sample);
+		fixup_sample_trace_cpu(sample, find_dispatch(&sample->data));
+		/* a damaged recording can name cpus the recording machine didn't have */
+		if (trace_replaying() && sample->trace.cpu > (uint32_t)get_max_cpu())
+			continue;
 		handle_trace_point(&sample->data, sample->trace.cpu, sample->trace.time);
 	}
 }
@@ -28,19 +28,98 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <stdint.h>
+#include <pthread.h>
 
 using namespace std;
 
 #include "perf.h"
 class perf_event;
 
+/*
+ * Bump allocator for perf records that cannot be referenced in place
+ * in the mmap ring. Chunks are kept across measurement windows so that
+ * reset() is O(1) and steady state processing does no heap traffic.
+ */
+class record_arena {
+	vector<unsigned char *> chunks;
+	unsigned int current;
+	size_t used;
+public:
+	record_arena(void);
+	~record_arena(void);
+
+	void *alloc(size_t size);
+	void reset(void);
+	void release(void);
+};
+
+
+/* sort key of one record, extracted once per window for the k-way merge */
+struct record_key {
+	uint64_t time;
+	uint32_t run;
+	uint32_t index;
+	void *record;
+};
+
+#define TRACE_MAX_FIELDS	4
+
+struct trace_dispatch;
+
+typedef void (*trace_handler)(struct trace_dispatch *dispatch, void *trace, int cpu, uint64_t time);
+
+/*
+ * Static description of a tracepoint a bundle wants to handle: the
+ * handler and the names of the fields it reads, in the order the
+ * handler expects them in trace_dispatch::fields.
+ */
+struct trace_point_desc {
+	const char *name;
+	trace_handler handler;
+	const char *fields[TRACE_MAX_FIELDS];
+};
+
+/* per tracepoint id entry, resolved once in add_event() */
+struct trace_dispatch {
+	trace_handler handler;
+	struct tep_event *event;
+	struct tep_format_field *cpu_id;
+	struct tep_format_field *fields[TRACE_MAX_FIELDS];
+};
+
+/* drain the perf rings continuously from a reader thread (--stream) */
+extern int perf_stream_mode;
+
+extern uint64_t perf_lost_records(void);
+
+extern int trace_field_val(struct trace_dispatch *dispatch, int field, void *trace, unsigned long long *val);
 
 class  perf_bundle {
 protected:
 	vector<class perf_event *> events;
+	vector<unsigned int> runs;
+	vector<struct record_key> keys;
+	vector<struct record_key> heap;
+
+	const struct trace_point_desc *trace_points;
+	vector<struct trace_dispatch> dispatch;
+
+	pthread_t stream_thread;
+
+	void add_dispatch(unsigned int trace_type);
+	void start_streaming(void);
+	void stop_streaming(void);
 public:
-	vector<void *> records;
-	virtual ~perf_bundle() {};
+	unsigned int id;	/* creation order, names the bundle in --record files */
+	record_arena arena;
+	bool streaming;
+	volatile bool stream_stop;
+	int epoll_fd;
+
+	perf_bundle(void);
+	perf_bundle(const struct trace_point_desc *points);
+	virtual ~perf_bundle();
 
 	virtual void release(void);
 	bool add_event(const char *system_name, const char *event_name);
@@ -50,6 +129,9 @@ public:
 	void clear(void);
 
 	void process(void);
+	uint64_t lost_records(void);
+
+	struct trace_dispatch *find_dispatch(void *trace);
 
 	virtual void handle_trace_point(void *trace, int cpu = 0, uint64_t time = 0);
 };
@@ -0,0 +1,493 @@
+/*
+ * Copyright 2026, the PowerTOP contributors
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ */
+
+#include <set>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "perf_record.h"
+#include "perf_event.h"
+#include "perf.h"
+#include "../lib.h"
+
+/*
+ * File layout: an 8 byte magic, the u32 number of cpus of the recording
+ * machine and a u32 of padding, then records of a rec_header followed by
+ * 'length' bytes of payload. Payloads are padded to 8 bytes so the perf
+ * records inside them stay aligned the way they were in the ring.
+ *
+ * REC_FORMAT:	u32 names_len, u32 format_len, "system\0event\0", format text
+ * REC_WINDOW:	u32 bundle, u32 nr_runs, u32 records[nr_runs], padding,
+ *		then the perf records of all runs back to back
+ * REC_SNAPSHOT:	u32 kind, u32 size, then the snapshot data
+ */
+#define TRACE_FILE_MAGIC	"PTTRACE2"
+#define TRACE_FILE_MAGIC_LEN	8
+#define TRACE_FILE_HEADER	16
+
+#define REC_FORMAT	1
+#define REC_WINDOW	2
+#define REC_SNAPSHOT	3
+
+#define PAD8(x)		(((x) + 7) & ~((size_t)7))
+
+struct rec_header {
+	uint32_t	type;
+	uint32_t	length;
+};
+
+static FILE *record_file;
+static bool header_written;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+static set<string> recorded_formats;
+
+static unsigned char *replay_data;
+static size_t replay_size;
+static unsigned int replay_cpus;
+static vector<size_t> replay_cursor;	/* per bundle, where to look for its next window */
+static vector<size_t> snapshot_cursor;	/* per snapshot kind */
+
+/*
+ * The header carries the cpu count, which isn't known before the cpus are
+ * enumerated; it is written with the first record instead.
+ */
+int trace_record_open(const char *filename)
+{
+	record_file = fopen(filename, "w");
+	if (!record_file)
+		return -1;
+	header_written = false;
+	return 0;
+}
+
+int trace_replay_open(const char *filename)
+{
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) || st.st_size < TRACE_FILE_HEADER) {
+		close(fd);
+		return -1;
+	}
+
+	/* private and writable: processing fixes up the sample cpu in place */
+	data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return -1;
+
+	replay_cpus = *(uint32_t *)((unsigned char *)data + TRACE_FILE_MAGIC_LEN);
+	if (memcmp(data, TRACE_FILE_MAGIC, TRACE_FILE_MAGIC_LEN) || replay_cpus == 0) {
+		munmap(data, st.st_size);
+		return -1;
+	}
+
+	replay_data = (unsigned char *)data;
+	replay_size = st.st_size;
+	return 0;
+}
+
+void trace_record_close(void)
+{
+	if (record_file && fclose(record_file))
+		fprintf(stderr, _("Writing the trace file failed\n"));
+	record_file = NULL;
+}
+
+bool trace_recording(void)
+{
+	return record_file != NULL;
+}
+
+bool trace_replaying(void)
+{
+	return replay_data != NULL;
+}
+
+unsigned int trace_replay_cpus(void)
+{
+	return replay_cpus;
+}
+
+static int write_failed(void)
+{
+	fprintf(stderr, _("Writing the trace file failed, recording stopped\n"));
+	fclose(record_file);
+	record_file = NULL;
+	return -1;
+}
+
+/*
+ * Called with record_lock held. A failed write stops the recording; the
+ * last record may be cut short, which replaying ignores.
+ */
+static int write_data(const void *data, size_t size)
+{
+	uint32_t cpus[2];
+
+	if (!record_file)
+		return -1;
+
+	if (!header_written) {
+		cpus[0] = get_max_cpu() + 1;
+		cpus[1] = 0;
+		if (fwrite(TRACE_FILE_MAGIC, TRACE_FILE_MAGIC_LEN, 1, record_file) != 1 ||
+		    fwrite(cpus, sizeof(cpus), 1, record_file) != 1)
+			return write_failed();
+		header_written = true;
+	}
+
+	if (!size || fwrite(data, size, 1, record_file) == 1)
+		return 0;
+	return write_failed();
+}
+
+static int write_record(uint32_t type, size_t length)
+{
+	struct rec_header header;
+
+	header.type = type;
+	header.length = PAD8(length);
+	return write_data(&header, sizeof(header));
+}
+
+static int write_padding(size_t length)
+{
+	static const char zeroes[8] = { 0 };
+
+	return write_data(zeroes, PAD8(length) - length);
+}
+
+void record_format(const char *system_name, const char *event_name)
+{
+	uint32_t lengths[2];
+	string key;
+	char *buf;
+	int size;
+
+	if (!record_file)
+		return;
+
+	key = string(system_name) + ":" + event_name;
+
+	pthread_mutex_lock(&record_lock);
+	if (recorded_formats.count(key)) {
+		pthread_mutex_unlock(&record_lock);
+		return;
+	}
+	recorded_formats.insert(key);
+
+	buf = tracefs_event_file_read(NULL, system_name, event_name, "format", &size);
+	if (buf && size > 0) {
+		lengths[0] = strlen(system_name) + 1 + strlen(event_name) + 1;
+		lengths[1] = size;
+
+		if (!write_record(REC_FORMAT, sizeof(lengths) + lengths[0] + lengths[1]) &&
+		    !write_data(lengths, sizeof(lengths)) &&
+		    !write_data(system_name, strlen(system_name) + 1) &&
+		    !write_data(event_name, strlen(event_name) + 1) &&
+		    !write_data(buf, size))
+			write_padding(sizeof(lengths) + lengths[0] + lengths[1]);
+	}
+	free(buf);
+	pthread_mutex_unlock(&record_lock);
+}
+
+void record_window(unsigned int bundle, const vector<unsigned int> &runs, const vector<struct record_key> &keys)
+{
+	struct perf_event_header *header;
+	uint32_t head[2], count;
+	size_t length, counts;
+	unsigned int i;
+
+	if (!record_file)
+		return;
+
+	head[0] = bundle;
+	head[1] = runs.size() - 1;
+	counts = sizeof(head) + head[1] * sizeof(uint32_t);
+
+	length = PAD8(counts);
+	for (i = 0; i < keys.size(); i++)
+		length += ((struct perf_event_header *)keys[i].record)->size;
+
+	pthread_mutex_lock(&record_lock);
+	if (write_record(REC_WINDOW, length) || write_data(head, sizeof(head)))
+		goto out;
+	for (i = 0; i + 1 < runs.size(); i++) {
+		count = runs[i + 1] - runs[i];
+		if (write_data(&count, sizeof(count)))
+			goto out;
+	}
+	if (write_padding(counts))
+		goto out;
+	for (i = 0; i < keys.size(); i++) {
+		header = (struct perf_event_header *)keys[i].record;
+		if (write_data(header, header->size))
+			break;
+	}
+out:
+	pthread_mutex_unlock(&record_lock);
+}
+
+void record_snapshot(unsigned int kind, const class trace_snapshot &snapshot)
+{
+	const vector<unsigned char> &data = snapshot.buffer();
+	uint32_t head[2];
+
+	if (!record_file)
+		return;
+
+	head[0] = kind;
+	head[1] = data.size();
+
+	pthread_mutex_lock(&record_lock);
+	if (!write_record(REC_SNAPSHOT, sizeof(head) + data.size()) &&
+	    !write_data(head, sizeof(head)) &&
+	    !write_data(data.data(), data.size()))
+		write_padding(sizeof(head) + data.size());
+	pthread_mutex_unlock(&record_lock);
+}
+
+static struct rec_header *replay_next(size_t *offset)
+{
+	struct rec_header *header;
+
+	if (*offset + sizeof(*header) > replay_size)
+		return NULL;
+
+	header = (struct rec_header *)(replay_data + *offset);
+	if (*offset + sizeof(*header) + header->length > replay_size)
+		return NULL;
+
+	*offset += sizeof(*header) + header->length;
+	return header;
+}
+
+/* returns the trace type of a recorded event, or -1 if it wasn't recorded */
+int replay_format(const char *system_name, const char *event_name)
+{
+	struct rec_header *header;
+	struct tep_event *event;
+	uint32_t *lengths;
+	char *names;
+	size_t offset;
+
+	if (!perf_event::tep)
+		perf_event::tep = tep_alloc();
+	if (!perf_event::tep)
+		return -1;
+
+	event = tep_find_event_by_name(perf_event::tep, system_name, event_name);
+	if (event)
+		return event->id;
+
+	offset = TRACE_FILE_HEADER;
+	while ((header = replay_next(&offset))) {
+		if (header->type != REC_FORMAT || header->length < 2 * sizeof(uint32_t))
+			continue;
+
+		lengths = (uint32_t *)(header + 1);
+		names = (char *)(lengths + 2);
+		if ((size_t)lengths[0] + lengths[1] > header->length - 2 * sizeof(uint32_t))
+			continue;
+		if (strcmp(names, system_name) || strcmp(names + strlen(names) + 1, event_name))
+			continue;
+
+		tep_parse_event(perf_event::tep, names + lengths[0], lengths[1], system_name);
+		event = tep_find_event_by_name(perf_event::tep, system_name, event_name);
+		return event ? event->id : -1;
+	}
+	return -1;
+}
+
+/*
+ * Hand out the next recorded window of a bundle. The keys point into the
+ * mapped file, which stays mapped until exit.
+ */
+bool replay_window(unsigned int bundle, vector<unsigned int> &runs, vector<struct record_key> &keys)
+{
+	struct perf_event_header *record;
+	struct rec_header *header;
+	struct record_key key;
+	unsigned char *pos, *end;
+	uint32_t *head, i, j;
+
+	if (replay_cursor.size() <= bundle)
+		replay_cursor.resize(bundle + 1, TRACE_FILE_HEADER);
+
+	while ((header = replay_next(&replay_cursor[bundle]))) {
+		if (header->type != REC_WINDOW || header->length < 2 * sizeof(uint32_t))
+			continue;
+
+		head = (uint32_t *)(header + 1);
+		if (head[0] != bundle)
+			continue;
+		if (PAD8(2 * sizeof(uint32_t) + (size_t)head[1] * sizeof(uint32_t)) > header->length)
+			continue;
+
+		pos = (unsigned char *)(header + 1) + PAD8(2 * sizeof(uint32_t) + (size_t)head[1] * sizeof(uint32_t));
+		end = (unsigned char *)(header + 1) + header->length;
+
+		for (i = 0; i < head[1] && pos < end; i++) {
+			if (!head[2 + i])
+				continue;
+
+			runs.push_back(keys.size());
+			for (j = 0; j < head[2 + i]; j++) {
+				record = (struct perf_event_header *)pos;
+				if (pos + sizeof(*record) > end || record->size < sizeof(*record) ||
+				    pos + record->size > end)
+					break;
+
+				key.time = 0;
+				key.run = runs.size() - 1;
+				key.index = 0;
+				key.record = record;
+				keys.push_back(key);
+				pos += record->size;
+			}
+			/* truncated; keep what was complete and ignore the rest */
+			if (j < head[2 + i])
+				pos = end;
+			if (runs.back() == keys.size())
+				runs.pop_back();
+		}
+		return true;
+	}
+	return false;
+}
+
+/* hand out the next recorded snapshot of a kind */
+bool replay_snapshot(unsigned int kind, class trace_snapshot &snapshot)
+{
+	struct rec_header *header;
+	uint32_t *head;
+
+	if (snapshot_cursor.size() <= kind)
+		snapshot_cursor.resize(kind + 1, TRACE_FILE_HEADER);
+
+	while ((header = replay_next(&snapshot_cursor[kind]))) {
+		if (header->type != REC_SNAPSHOT || header->length < 2 * sizeof(uint32_t))
+			continue;
+
+		head = (uint32_t *)(header + 1);
+		if (head[0] != kind || head[1] > header->length - 2 * sizeof(uint32_t))
+			continue;
+
+		snapshot.assign((unsigned char *)(head + 2), head[1]);
+		return true;
+	}
+	return false;
+}
+
+void trace_snapshot::put(const void *ptr, size_t size)
+{
+	data.insert(data.end(), (const unsigned char *)ptr, (const unsigned char *)ptr + size);
+}
+
+void trace_snapshot::put_string(const char *str)
+{
+	uint32_t len = strlen(str);
+
+	put_u32(len);
+	put(str, len);
+}
+
+bool trace_snapshot::get(void *ptr, size_t size)
+{
+	if (bad || size > data.size() - pos) {
+		bad = true;
+		memset(ptr, 0, size);
+		return false;
+	}
+	memcpy(ptr, &data[pos], size);
+	pos += size;
+	return true;
+}
+
+uint32_t trace_snapshot::get_u32(void)
+{
+	uint32_t value;
+
+	get(&value, sizeof(value));
+	return value;
+}
+
+uint64_t trace_snapshot::get_u64(void)
+{
+	uint64_t value;
+
+	get(&value, sizeof(value));
+	return value;
+}
+
+double trace_snapshot::get_double(void)
+{
+	double value;
+
+	get(&value, sizeof(value));
+	return value;
+}
+
+string trace_snapshot::get_string(void)
+{
+	uint32_t len = get_u32();
+	string str;
+
+	if (bad || len > data.size() - pos) {
+		bad = true;
+		return str;
+	}
+	str.assign((const char *)&data[pos], len);
+	pos += len;
+	return str;
+}
+
+/* like get_string(), cut to fit a fixed size buffer */
+void trace_snapshot::get_string(char *buffer, size_t size)
+{
+	string str = get_string();
+
+	snprintf(buffer, size, "%s", str.c_str());
+}
+
+void trace_snapshot::assign(const unsigned char *ptr, size_t size)
+{
+	data.assign(ptr, ptr + size);
+	pos = 0;
+	bad = false;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2026, the PowerTOP contributors
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ */
+#ifndef _INCLUDE_GUARD_PERF_RECORD_H_
+#define _INCLUDE_GUARD_PERF_RECORD_H_
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "perf_bundle.h"
+
+using namespace std;
+
+/*
+ * --record / --replay: the raw perf records every bundle processes in a
+ * window, and the tracepoint formats needed to decode them, are written to
+ * a file of length prefixed records. Replaying feeds them back through
+ * perf_bundle::process() instead of the kernel's rings.
+ *
+ * What the traces don't carry (cpu topology, C/P state counters, device
+ * statistics) is saved in snapshots, which the owners of that state fill
+ * and read back in the same order.
+ */
+extern int trace_record_open(const char *filename);
+extern int trace_replay_open(const char *filename);
+extern void trace_record_close(void);
+
+extern bool trace_recording(void);
+extern bool trace_replaying(void);
+
+/* number of cpus of the recording machine, sizes every per-cpu table in a replay */
+extern unsigned int trace_replay_cpus(void);
+
+class trace_snapshot {
+	vector<unsigned char> data;
+	size_t pos;
+	bool bad;
+
+	void put(const void *ptr, size_t size);
+	bool get(void *ptr, size_t size);
+public:
+	trace_snapshot(void) : pos(0), bad(false) {};
+
+	void put_u32(uint32_t value) { put(&value, sizeof(value)); };
+	void put_u64(uint64_t value) { put(&value, sizeof(value)); };
+	void put_double(double value) { put(&value, sizeof(value)); };
+	void put_string(const char *str);
+
+	uint32_t get_u32(void);
+	uint64_t get_u64(void);
+	double get_double(void);
+	string get_string(void);
+	void get_string(char *buffer, size_t size);
+
+	/* a short or garbled snapshot reads as zeroes from the first bad field on */
+	bool failed(void) { return bad; };
+
+	const vector<unsigned char> &buffer(void) const { return data; };
+	void assign(const unsigned char *ptr, size_t size);
+};
+
+#define SNAPSHOT_CPUS		0	/* topology, once before the first window */
+#define SNAPSHOT_WINDOW		1	/* counters and device statistics of a window */
+
+extern void record_snapshot(unsigned int kind, const class trace_snapshot &snapshot);
+extern bool replay_snapshot(unsigned int kind, class trace_snapshot &snapshot);
+
+extern void record_format(const char *system_name, const char *event_name);
+extern void record_window(unsigned int bundle, const vector<unsigned int> &runs, const vector<struct record_key> &keys);
+
+extern int replay_format(const char *system_name, const char *event_name);
+extern bool replay_window(unsigned int bundle, vector<unsigned int> &runs, vector<struct record_key> &keys);
+
+#endif
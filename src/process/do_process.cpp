@@ -51,8 +51,6 @@ static  class perf_bundle * perf_events;
 
 vector <class power_consumer *> all_power;
 
-vector< vector<class power_consumer *> > cpu_stack;
-
 vector<int> cpu_level;
 vector<int> cpu_credit;
 vector<class power_consumer *> cpu_blame;
@@ -65,57 +63,150 @@ vector<class power_consumer *> cpu_blame;
 #define LEVEL_WORK	6
 
 static uint64_t first_stamp, last_stamp;
+static uint64_t lost_events;
 
 double measurement_time;
 
+/*
+ * Per cpu stack of the consumers (process, irq, timer, work) that are
+ * currently running. Nesting is normally bounded by the handful of
+ * contexts that can interrupt each other, but lost exit events can pile
+ * entries up, so a stack grows when it has to. The per cpu blocks are
+ * cache line aligned and keep their arrays across windows.
+ *
+ * consumer_child_time() must charge the time to every consumer on the
+ * stack; instead of walking the stack, each cpu keeps a running total and
+ * every entry remembers the total at push time. The difference is
+ * charged when the entry is popped, or by settle_consumers() at the end.
+ */
+#define MIN_CONSUMER_DEPTH	16
+
+struct consumer_stack {
+	class power_consumer	**consumers;
+	uint64_t		*child_base;
+	uint64_t		child_time;
+	unsigned int		depth;
+	unsigned int		size;
+} __attribute__((aligned(64)));
+
+static struct consumer_stack *cpu_stack;
+static unsigned int cpu_stack_count;
+
+static inline struct consumer_stack *consumer_stack_of(unsigned int cpu)
+{
+	if (cpu >= cpu_stack_count)
+		return NULL;
+	return &cpu_stack[cpu];
+}
+
+static void grow_consumer_stack(struct consumer_stack *stack)
+{
+	class power_consumer **consumers;
+	uint64_t *child_base;
+	unsigned int size;
+
+	size = stack->size ? stack->size * 2 : MIN_CONSUMER_DEPTH;
+	consumers = new class power_consumer *[size];
+	child_base = new uint64_t[size];
+	if (stack->depth) {
+		memcpy(consumers, stack->consumers, stack->depth * sizeof(*consumers));
+		memcpy(child_base, stack->child_base, stack->depth * sizeof(*child_base));
+	}
+	delete [] stack->consumers;
+	delete [] stack->child_base;
+	stack->consumers = consumers;
+	stack->child_base = child_base;
+	stack->size = size;
+}
+
 static void push_consumer(unsigned int cpu, class power_consumer *consumer)
 {
-	if (cpu_stack.size() <= cpu)
-		cpu_stack.resize(cpu + 1);
-	cpu_stack[cpu].push_back(consumer);
+	struct consumer_stack *stack = consumer_stack_of(cpu);
+
+	if (!stack)
+		return;
+	if (stack->depth >= stack->size)
+		grow_consumer_stack(stack);
+	stack->consumers[stack->depth] = consumer;
+	stack->child_base[stack->depth] = stack->child_time;
+	stack->depth++;
 }
 
 static void pop_consumer(unsigned int cpu)
 {
-	if (cpu_stack.size() <= cpu)
-		cpu_stack.resize(cpu + 1);
+	struct consumer_stack *stack = consumer_stack_of(cpu);
 
-	if (cpu_stack[cpu].size())
-		cpu_stack[cpu].resize(cpu_stack[cpu].size()-1);
+	if (!stack || !stack->depth)
+		return;
+	stack->depth--;
+	stack->consumers[stack->depth]->child_runtime +=
+		stack->child_time - stack->child_base[stack->depth];
 }
 
 static int consumer_depth(unsigned int cpu)
 {
-	if (cpu_stack.size() <= cpu)
-		cpu_stack.resize(cpu + 1);
-	return cpu_stack[cpu].size();
+	struct consumer_stack *stack = consumer_stack_of(cpu);
+
+	if (!stack)
+		return 0;
+	return stack->depth;
 }
 
 static class power_consumer *current_consumer(unsigned int cpu)
 {
-	if (cpu_stack.size() <= cpu)
-		cpu_stack.resize(cpu + 1);
-	if (cpu_stack[cpu].size())
+	struct consumer_stack *stack = consumer_stack_of(cpu);
 
-		return cpu_stack[cpu][cpu_stack[cpu].size()-1];
-
-	return NULL;
+	if (!stack || !stack->depth)
+		return NULL;
+	return stack->consumers[stack->depth - 1];
 }
 
+/* consumers may already be freed here, so don't charge anything */
 static void clear_consumers(void)
 {
-	unsigned int i;
-	for (i = 0; i < cpu_stack.size(); i++)
-		cpu_stack[i].resize(0);
+	unsigned int count, cpu;
+
+	count = get_max_cpu() + 1;
+	if (count != cpu_stack_count) {
+		for (cpu = 0; cpu < cpu_stack_count; cpu++) {
+			delete [] cpu_stack[cpu].consumers;
+			delete [] cpu_stack[cpu].child_base;
+		}
+		free(cpu_stack);
+		cpu_stack = NULL;
+		cpu_stack_count = 0;
+		if (posix_memalign((void **)&cpu_stack, 64, count * sizeof(struct consumer_stack)))
+			return;
+		memset(cpu_stack, 0, count * sizeof(struct consumer_stack));
+		cpu_stack_count = count;
+	}
+	for (cpu = 0; cpu < cpu_stack_count; cpu++) {
+		cpu_stack[cpu].child_time = 0;
+		cpu_stack[cpu].depth = 0;
+	}
+}
+
+/* charge the pending child time of everything still on a stack */
+static void settle_consumers(void)
+{
+	struct consumer_stack *stack;
+	unsigned int cpu, i;
+
+	for (cpu = 0; cpu < cpu_stack_count; cpu++) {
+		stack = &cpu_stack[cpu];
+		for (i = 0; i < stack->depth; i++) {
+			stack->consumers[i]->child_runtime += stack->child_time - stack->child_base[i];
+			stack->child_base[i] = stack->child_time;
+		}
+	}
 }
 
 static void consumer_child_time(unsigned int cpu, uint64_t time)
 {
-	unsigned int i;
-	if (cpu_stack.size() <= cpu)
-		cpu_stack.resize(cpu + 1);
-	for (i = 0; i < cpu_stack[cpu].size(); i++)
-		cpu_stack[cpu][i]->child_runtime += time;
+	struct consumer_stack *stack = consumer_stack_of(cpu);
+
+	if (stack)
+		stack->child_time += time;
 }
 
 static void set_wakeup_pending(unsigned int cpu)
@@ -143,6 +234,8 @@ static int get_wakeup_pending(unsigned int cpu)
 
 static void change_blame(unsigned int cpu, class power_consumer *consumer, int level)
 {
+	if (cpu_level.size() <= cpu || cpu_blame.size() <= cpu)
+		return;
 	if (cpu_level[cpu] >= level)
 		return;
 	cpu_blame[cpu] = consumer;
@@ -167,11 +260,6 @@ static void consume_blame(unsigned int cpu)
 }
 
 
-class perf_process_bundle: public perf_bundle
-{
-	virtual void handle_trace_point(void *trace, int cpu, uint64_t time);
-};
-
 static bool comm_is_xorg(char *comm)
 {
 	return strcmp(comm, "Xorg") == 0 || strcmp(comm, "X") == 0;
@@ -202,454 +290,466 @@ static char * get_tep_field_str(void *trace, struct tep_event *event, struct tep
 	return (char *)trace + field->offset;
 }
 
-void perf_process_bundle::handle_trace_point(void *trace, int cpu, uint64_t time)
+static void handle_sched_switch(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
 {
-	struct tep_event *event;
-	struct tep_record rec; /* holder */
+	class process *old_proc = NULL;
+	class process *new_proc  = NULL;
 	struct tep_format_field *field;
 	unsigned long long val;
-	int type;
-	int ret;
+	const char *next_comm;
+	int next_pid;
+	int prev_pid;
+
+	field = d->fields[0];
+	if (!field || !(field->flags & TEP_FIELD_IS_STRING))
+		return; /* ?? */
 
-	rec.data = trace;
+	next_comm = get_tep_field_str(trace, d->event, field);
 
-	type = tep_data_type(perf_event::tep, &rec);
-	event = tep_find_event(perf_event::tep, type);
-	if (!event)
+	if (trace_field_val(d, 1, trace, &val) < 0)
 		return;
+	next_pid = (int)val;
 
-	if (time < first_stamp)
-		first_stamp = time;
+	if (trace_field_val(d, 2, trace, &val) < 0)
+		return;
+	prev_pid = (int)val;
 
-	if (time > last_stamp) {
-		last_stamp = time;
-		measurement_time = (0.0001 + last_stamp - first_stamp) / 1000000000 ;
+	/* find new process pointer */
+	new_proc = find_create_process(next_comm, next_pid);
+
+	/* find the old process pointer */
+
+	while  (consumer_depth(cpu) > 1) {
+		pop_consumer(cpu);
 	}
 
-	if (strcmp(event->name, "sched_switch") == 0) {
-		class process *old_proc = NULL;
-		class process *new_proc  = NULL;
-		const char *next_comm;
-		int next_pid;
-		int prev_pid;
+	if (consumer_depth(cpu) == 1)
+		old_proc = (class process *)current_consumer(cpu);
 
-		field = tep_find_any_field(event, "next_comm");
-		if (!field || !(field->flags & TEP_FIELD_IS_STRING))
-			return; /* ?? */
+	if (old_proc && strcmp(old_proc->name(), "process"))
+		old_proc = NULL;
 
-		next_comm = get_tep_field_str(trace, event, field);
+	/* retire the old process */
 
-		ret = tep_get_field_val(NULL, event, "next_pid", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		next_pid = (int)val;
+	if (old_proc) {
+		old_proc->deschedule_thread(time, prev_pid);
+		old_proc->waker = NULL;
+	}
 
-		ret = tep_get_field_val(NULL, event, "prev_pid", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		prev_pid = (int)val;
+	if (consumer_depth(cpu))
+		pop_consumer(cpu);
 
-		/* find new process pointer */
-		new_proc = find_create_process(next_comm, next_pid);
+	push_consumer(cpu, new_proc);
 
-		/* find the old process pointer */
+	/* start new process */
+	new_proc->schedule_thread(time, next_pid);
 
-		while  (consumer_depth(cpu) > 1) {
-			pop_consumer(cpu);
+	if (strncmp(next_comm,"migration/", 10) && strncmp(next_comm,"kworker/", 8) && strncmp(next_comm, "kondemand/",10)) {
+		if (next_pid) {
+			/* If someone woke us up.. blame him instead */
+			if (new_proc->waker) {
+				change_blame(cpu, new_proc->waker, LEVEL_PROCESS);
+			} else {
+				change_blame(cpu, new_proc, LEVEL_PROCESS);
+			}
 		}
 
-		if (consumer_depth(cpu) == 1)
-			old_proc = (class process *)current_consumer(cpu);
+		consume_blame(cpu);
+	}
+	new_proc->waker = NULL;
+}
 
-		if (old_proc && strcmp(old_proc->name(), "process"))
-			old_proc = NULL;
+static void handle_sched_wakeup(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	class power_consumer *from = NULL;
+	class process *dest_proc = NULL;
+	class process *from_proc = NULL;
+	struct tep_format_field *field;
+	unsigned long long val;
+	const char *comm;
+	int flags;
+	int pid;
 
-		/* retire the old process */
+	if (trace_field_val(d, 0, trace, &val) < 0)
+		return;
+	flags = (int)val;
 
-		if (old_proc) {
-			old_proc->deschedule_thread(time, prev_pid);
-			old_proc->waker = NULL;
+	if ( (flags & TRACE_FLAG_HARDIRQ) || (flags & TRACE_FLAG_SOFTIRQ)) {
+		class timer *timer;
+		timer = (class timer *) current_consumer(cpu);
+		if (timer && strcmp(timer->name(), "timer")==0) {
+			if (strcmp(timer->handler, "delayed_work_timer_fn") &&
+			    strcmp(timer->handler, "hrtimer_wakeup") &&
+			    strcmp(timer->handler, "it_real_fn"))
+				from = timer;
 		}
+		/* woken from interrupt */
+		/* TODO: find the current irq handler and set "from" to that */
+	} else {
+		from = current_consumer(cpu);
+	}
 
-		if (consumer_depth(cpu))
-			pop_consumer(cpu);
 
-		push_consumer(cpu, new_proc);
+	field = d->fields[1];
+	if (!field || !(field->flags & TEP_FIELD_IS_STRING))
+		return;
 
-		/* start new process */
-		new_proc->schedule_thread(time, next_pid);
+	comm = get_tep_field_str(trace, d->event, field);
 
-		if (strncmp(next_comm,"migration/", 10) && strncmp(next_comm,"kworker/", 8) && strncmp(next_comm, "kondemand/",10)) {
-			if (next_pid) {
-				/* If someone woke us up.. blame him instead */
-				if (new_proc->waker) {
-					change_blame(cpu, new_proc->waker, LEVEL_PROCESS);
-				} else {
-					change_blame(cpu, new_proc, LEVEL_PROCESS);
-				}
-			}
+	if (trace_field_val(d, 2, trace, &val) < 0)
+		return;
+	pid = (int)val;
 
-			consume_blame(cpu);
-		}
-		new_proc->waker = NULL;
-	}
-	else if (strcmp(event->name, "sched_wakeup") == 0) {
-		class power_consumer *from = NULL;
-		class process *dest_proc = NULL;
-		class process *from_proc = NULL;
-		const char *comm;
-		int flags;
-		int pid;
-
-		ret = tep_get_common_field_val(NULL, event, "common_flags", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		flags = (int)val;
-
-		if ( (flags & TRACE_FLAG_HARDIRQ) || (flags & TRACE_FLAG_SOFTIRQ)) {
-			class timer *timer;
-			timer = (class timer *) current_consumer(cpu);
-			if (timer && strcmp(timer->name(), "timer")==0) {
-				if (strcmp(timer->handler, "delayed_work_timer_fn") &&
-				    strcmp(timer->handler, "hrtimer_wakeup") &&
-				    strcmp(timer->handler, "it_real_fn"))
-					from = timer;
-			}
-			/* woken from interrupt */
-			/* TODO: find the current irq handler and set "from" to that */
-		} else {
-			from = current_consumer(cpu);
-		}
+	dest_proc = find_create_process(comm, pid);
 
+	if (from && strcmp(from->name(), "process")!=0){
+		/* not a process doing the wakeup */
+		from = NULL;
+		from_proc = NULL;
+	} else {
+		from_proc = (class process *) from;
+	}
 
-		field = tep_find_any_field(event, "comm");
+	if (from_proc && (dest_proc->running == 0) && (dest_proc->waker == NULL) && (pid != 0) && !dont_blame_me(from_proc->comm))
+		dest_proc->waker = from;
+	if (from)
+		dest_proc->last_waker = from;
 
-		if (!field || !(field->flags & TEP_FIELD_IS_STRING))
- 			return;
+	/* Account processes that wake up X specially */
+	if (from && dest_proc && comm_is_xorg(dest_proc->comm))
+		from->xwakes ++ ;
+}
 
-		comm = get_tep_field_str(trace, event, field);
+static void handle_irq_handler_entry(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	class interrupt *irq = NULL;
+	struct tep_format_field *field;
+	unsigned long long val;
+	const char *handler;
+	int nr;
 
-		ret = tep_get_field_val(NULL, event, "pid", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		pid = (int)val;
+	field = d->fields[0];
+	if (!field || !(field->flags & TEP_FIELD_IS_STRING))
+		return; /* ?? */
 
-		dest_proc = find_create_process(comm, pid);
+	handler = get_tep_field_str(trace, d->event, field);
 
-		if (from && strcmp(from->name(), "process")!=0){
-			/* not a process doing the wakeup */
-			from = NULL;
-			from_proc = NULL;
-		} else {
-			from_proc = (class process *) from;
-		}
+	if (trace_field_val(d, 1, trace, &val) < 0)
+		return;
+	nr = (int)val;
 
-		if (from_proc && (dest_proc->running == 0) && (dest_proc->waker == NULL) && (pid != 0) && !dont_blame_me(from_proc->comm))
-			dest_proc->waker = from;
-		if (from)
-			dest_proc->last_waker = from;
+	irq = find_create_interrupt(handler, nr, cpu);
 
-		/* Account processes that wake up X specially */
-		if (from && dest_proc && comm_is_xorg(dest_proc->comm))
-			from->xwakes ++ ;
 
-	}
-	else if (strcmp(event->name, "irq_handler_entry") == 0) {
-		class interrupt *irq = NULL;
-		const char *handler;
-		int nr;
+	push_consumer(cpu, irq);
 
-		field = tep_find_any_field(event, "name");
-		if (!field || !(field->flags & TEP_FIELD_IS_STRING))
-			return; /* ?? */
+	irq->start_interrupt(time);
 
-		handler = get_tep_field_str(trace, event, field);
+	if (!irq->timer)
+		change_blame(cpu, irq, LEVEL_HARDIRQ);
+}
 
-		ret = tep_get_field_val(NULL, event, "irq", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		nr = (int)val;
+/* irq_handler_exit and softirq_exit */
+static void handle_irq_exit(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	class interrupt *irq = NULL;
+	uint64_t t;
 
-		irq = find_create_interrupt(handler, nr, cpu);
+	/* find interrupt (top of stack) */
+	irq = (class interrupt *)current_consumer(cpu);
+	if (!irq || strcmp(irq->name(), "interrupt"))
+		return;
+	pop_consumer(cpu);
+	/* retire interrupt */
+	t = irq->end_interrupt(time);
+	consumer_child_time(cpu, t);
+}
 
+static void handle_softirq_entry(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	class interrupt *irq = NULL;
+	unsigned long long val;
+	int vec;
 
-		push_consumer(cpu, irq);
+	if (trace_field_val(d, 0, trace, &val) < 0) {
+		fprintf(stderr, "softirq_entry event returned no vector number?\n");
+		return;
+	}
+	vec = (int)val;
 
-		irq->start_interrupt(time);
+	irq = find_create_softirq(vec);
+	if (!irq)
+		return;
 
-		if (strstr(irq->handler, "timer") ==NULL)
-			change_blame(cpu, irq, LEVEL_HARDIRQ);
+	push_consumer(cpu, irq);
 
-	}
+	irq->start_interrupt(time);
+	change_blame(cpu, irq, LEVEL_SOFTIRQ);
+}
 
-	else if (strcmp(event->name, "irq_handler_exit") == 0) {
-		class interrupt *irq = NULL;
-		uint64_t t;
+static void handle_timer_expire_entry(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	class timer *timer = NULL;
+	unsigned long long val;
+	uint64_t function;
+	uint64_t tmr;
 
-		/* find interrupt (top of stack) */
-		irq = (class interrupt *)current_consumer(cpu);
-		if (!irq || strcmp(irq->name(), "interrupt"))
-			return;
-		pop_consumer(cpu);
-		/* retire interrupt */
-		t = irq->end_interrupt(time);
-		consumer_child_time(cpu, t);
+	if (trace_field_val(d, 0, trace, &val) < 0) {
+		fprintf(stderr, "timer_expire_entry event returned no function value?\n");
+		return;
 	}
+	function = (uint64_t)val;
 
-	else if (strcmp(event->name, "softirq_entry") == 0) {
-		class interrupt *irq = NULL;
-		const char *handler = NULL;
-		int vec;
+	timer = find_create_timer(function);
 
-		ret = tep_get_field_val(NULL, event, "vec", &rec, &val, 0);
-                if (ret < 0) {
-                        fprintf(stderr, "softirq_entry event returned no vector number?\n");
-                        return;
-                }
-		vec = (int)val;
+	if (timer->is_deferred())
+		return;
 
-		if (vec <= 9)
-			handler = softirqs[vec];
+	if (trace_field_val(d, 1, trace, &val) < 0) {
+		fprintf(stderr, "softirq_entry event returned no timer ?\n");
+		return;
+	}
+	tmr = (uint64_t)val;
 
-		if (!handler)
-			return;
+	push_consumer(cpu, timer);
+	timer->fire(time, tmr);
 
-		irq = find_create_interrupt(handler, vec, cpu);
+	if (strcmp(timer->handler, "delayed_work_timer_fn"))
+		change_blame(cpu, timer, LEVEL_TIMER);
+}
 
-		push_consumer(cpu, irq);
+/* timer_expire_exit and hrtimer_expire_exit */
+static void handle_timer_expire_exit(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	class timer *timer = NULL;
+	unsigned long long val;
+	uint64_t tmr;
+	uint64_t t;
 
-		irq->start_interrupt(time);
-		change_blame(cpu, irq, LEVEL_SOFTIRQ);
-	}
-	else if (strcmp(event->name, "softirq_exit") == 0) {
-		class interrupt *irq = NULL;
-		uint64_t t;
+	if (trace_field_val(d, 0, trace, &val) < 0)
+		return;
+	tmr = (uint64_t)val;
 
-		irq = (class interrupt *) current_consumer(cpu);
-		if (!irq  || strcmp(irq->name(), "interrupt"))
-			return;
-		pop_consumer(cpu);
-		/* pop irq */
-		t = irq->end_interrupt(time);
-		consumer_child_time(cpu, t);
+	timer = (class timer *) current_consumer(cpu);
+	if (!timer || strcmp(timer->name(), "timer")) {
+		return;
 	}
-	else if (strcmp(event->name, "timer_expire_entry") == 0) {
-		class timer *timer = NULL;
-		uint64_t function;
-		uint64_t tmr;
-
-		ret = tep_get_field_val(NULL, event, "function", &rec, &val, 0);
-		if (ret < 0) {
-			fprintf(stderr, "timer_expire_entry event returned no function value?\n");
-			return;
-		}
-		function = (uint64_t)val;
+	pop_consumer(cpu);
+	t = timer->done(time, tmr);
+	if (t == ~0ULL) {
+		timer->fire(first_stamp, tmr);
+		t = timer->done(time, tmr);
+	}
+	consumer_child_time(cpu, t);
+}
 
-		timer = find_create_timer(function);
+static void handle_hrtimer_expire_entry(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	class timer *timer = NULL;
+	unsigned long long val;
+	uint64_t function;
+	uint64_t tmr;
 
-		if (timer->is_deferred())
-			return;
+	if (trace_field_val(d, 0, trace, &val) < 0)
+		return;
+	function = (uint64_t)val;
 
-		ret = tep_get_field_val(NULL, event, "timer", &rec, &val, 0);
-		if (ret < 0) {
-			fprintf(stderr, "softirq_entry event returned no timer ?\n");
-			return;
-		}
-		tmr = (uint64_t)val;
+	timer = find_create_timer(function);
 
-		push_consumer(cpu, timer);
-		timer->fire(time, tmr);
+	if (trace_field_val(d, 1, trace, &val) < 0)
+		return;
+	tmr = (uint64_t)val;
 
-		if (strcmp(timer->handler, "delayed_work_timer_fn"))
-			change_blame(cpu, timer, LEVEL_TIMER);
-	}
-	else if (strcmp(event->name, "timer_expire_exit") == 0) {
-		class timer *timer = NULL;
-		uint64_t tmr;
-		uint64_t t;
+	push_consumer(cpu, timer);
+	timer->fire(time, tmr);
 
-		ret = tep_get_field_val(NULL, event, "timer", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		tmr = (uint64_t)val;
+	if (strcmp(timer->handler, "delayed_work_timer_fn"))
+		change_blame(cpu, timer, LEVEL_TIMER);
+}
 
-		timer = (class timer *) current_consumer(cpu);
-		if (!timer || strcmp(timer->name(), "timer")) {
-			return;
-		}
-		pop_consumer(cpu);
-		t = timer->done(time, tmr);
-		if (t == ~0ULL) {
-			timer->fire(first_stamp, tmr);
-			t = timer->done(time, tmr);
-		}
-		consumer_child_time(cpu, t);
-	}
-	else if (strcmp(event->name, "hrtimer_expire_entry") == 0) {
-		class timer *timer = NULL;
-		uint64_t function;
-		uint64_t tmr;
+static void handle_workqueue_execute_start(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	class work *work = NULL;
+	unsigned long long val;
+	uint64_t function;
+	uint64_t wk;
 
-		ret = tep_get_field_val(NULL, event, "function", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		function = (uint64_t)val;
+	if (trace_field_val(d, 0, trace, &val) < 0)
+		return;
+	function = (uint64_t)val;
 
-		timer = find_create_timer(function);
+	if (trace_field_val(d, 1, trace, &val) < 0)
+		return;
+	wk = (uint64_t)val;
 
-		ret = tep_get_field_val(NULL, event, "hrtimer", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		tmr = (uint64_t)val;
+	work = find_create_work(function);
 
-		push_consumer(cpu, timer);
-		timer->fire(time, tmr);
 
-		if (strcmp(timer->handler, "delayed_work_timer_fn"))
-			change_blame(cpu, timer, LEVEL_TIMER);
-	}
-	else if (strcmp(event->name, "hrtimer_expire_exit") == 0) {
-		class timer *timer = NULL;
-		uint64_t tmr;
-		uint64_t t;
+	push_consumer(cpu, work);
+	work->fire(time, wk);
 
-		timer = (class timer *) current_consumer(cpu);
-		if (!timer || strcmp(timer->name(), "timer")) {
-			return;
-		}
 
-		ret = tep_get_field_val(NULL, event, "hrtimer", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		tmr = (uint64_t)val;
+	if (strcmp(work->handler, "do_dbs_timer") != 0 && strcmp(work->handler, "vmstat_update") != 0)
+		change_blame(cpu, work, LEVEL_WORK);
+}
 
-		pop_consumer(cpu);
-		t = timer->done(time, tmr);
-		if (t == ~0ULL) {
-			timer->fire(first_stamp, tmr);
-			t = timer->done(time, tmr);
-		}
-		consumer_child_time(cpu, t);
+static void handle_workqueue_execute_end(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	class work *work = NULL;
+	unsigned long long val;
+	uint64_t t;
+	uint64_t wk;
+
+	if (trace_field_val(d, 0, trace, &val) < 0)
+		return;
+	wk = (uint64_t)val;
+
+	work = (class work *) current_consumer(cpu);
+	if (!work || strcmp(work->name(), "work")) {
+		return;
 	}
-	else if (strcmp(event->name, "workqueue_execute_start") == 0) {
-		class work *work = NULL;
-		uint64_t function;
-		uint64_t wk;
+	pop_consumer(cpu);
+	t = work->done(time, wk);
+	if (t == ~0ULL) {
+		work->fire(first_stamp, wk);
+		t = work->done(time, wk);
+	}
+	consumer_child_time(cpu, t);
+}
 
-		ret = tep_get_field_val(NULL, event, "function", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		function = (uint64_t)val;
+static void handle_cpu_idle(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	unsigned long long val;
 
-		ret = tep_get_field_val(NULL, event, "work", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		wk = (uint64_t)val;
+	if (trace_field_val(d, 0, trace, &val) < 0)
+		return;
+	if (val == (unsigned int)-1)
+		consume_blame(cpu);
+	else
+		set_wakeup_pending(cpu);
+}
 
-		work = find_create_work(function);
+static void handle_power_start(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	set_wakeup_pending(cpu);
+}
 
+static void handle_power_end(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	consume_blame(cpu);
+}
 
-		push_consumer(cpu, work);
-		work->fire(time, wk);
+/*
+ * any kernel contains only one of the i915_gem_ring_dispatch and
+ * i915_gem_request_submit tracepoints, the latter one got replaced
+ * by the former one
+ */
+static void handle_gpu_request(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	class power_consumer *consumer = NULL;
+	unsigned long long val;
+	int flags;
 
+	if (trace_field_val(d, 0, trace, &val) < 0)
+		return;
+	flags = (int)val;
 
-		if (strcmp(work->handler, "do_dbs_timer") != 0 && strcmp(work->handler, "vmstat_update") != 0)
-			change_blame(cpu, work, LEVEL_WORK);
+	consumer = current_consumer(cpu);
+	/* currently we don't count graphic requests submitted from irq contect */
+	if ( (flags & TRACE_FLAG_HARDIRQ) || (flags & TRACE_FLAG_SOFTIRQ)) {
+		consumer = NULL;
 	}
-	else if (strcmp(event->name, "workqueue_execute_end") == 0) {
-		class work *work = NULL;
-		uint64_t t;
-		uint64_t wk;
 
-		ret = tep_get_field_val(NULL, event, "work", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		wk = (uint64_t)val;
 
-		work = (class work *) current_consumer(cpu);
-		if (!work || strcmp(work->name(), "work")) {
-			return;
+	/* if we are X, and someone just woke us, account the GPU op to the guy waking us */
+	if (consumer && strcmp(consumer->name(), "process")==0) {
+		class process *proc = NULL;
+		proc = (class process *) consumer;
+		if (comm_is_xorg(proc->comm) && proc->last_waker) {
+			consumer = proc->last_waker;
 		}
-		pop_consumer(cpu);
-		t = work->done(time, wk);
-		if (t == ~0ULL) {
-			work->fire(first_stamp, wk);
-			t = work->done(time, wk);
-		}
-		consumer_child_time(cpu, t);
 	}
-	else if (strcmp(event->name, "cpu_idle") == 0) {
-		tep_get_field_val(NULL, event, "state", &rec, &val, 0);
-		if (val == (unsigned int)-1)
-			consume_blame(cpu);
-		else
-			set_wakeup_pending(cpu);
-	}
-	else if (strcmp(event->name, "power_start") == 0) {
-		set_wakeup_pending(cpu);
-	}
-	else if (strcmp(event->name, "power_end") == 0) {
-		consume_blame(cpu);
+
+
+
+	if (consumer) {
+		consumer->gpu_ops++;
 	}
-	else if (strcmp(event->name, "i915_gem_ring_dispatch") == 0
-	 || strcmp(event->name, "i915_gem_request_submit") == 0) {
-		/* any kernel contains only one of the these tracepoints,
-		 * the latter one got replaced by the former one */
-		class power_consumer *consumer = NULL;
-		int flags;
-
-		ret = tep_get_common_field_val(NULL, event, "common_flags", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		flags = (int)val;
+}
 
-		consumer = current_consumer(cpu);
-		/* currently we don't count graphic requests submitted from irq contect */
-		if ( (flags & TRACE_FLAG_HARDIRQ) || (flags & TRACE_FLAG_SOFTIRQ)) {
-			consumer = NULL;
-		}
+static void handle_writeback_inode_dirty(struct trace_dispatch *d, void *trace, int cpu, uint64_t time)
+{
+	static uint64_t prev_time;
+	class power_consumer *consumer = NULL;
+	unsigned long long val;
+	int dev;
 
+	consumer = current_consumer(cpu);
 
-		/* if we are X, and someone just woke us, account the GPU op to the guy waking us */
-		if (consumer && strcmp(consumer->name(), "process")==0) {
-			class process *proc = NULL;
-			proc = (class process *) consumer;
-			if (comm_is_xorg(proc->comm) && proc->last_waker) {
-				consumer = proc->last_waker;
-			}
-		}
+	if (trace_field_val(d, 0, trace, &val) < 0)
+		return;
+	dev = (int)val;
 
+	if (consumer && strcmp(consumer->name(),
+		"process")==0 && dev > 0) {
 
+		consumer->disk_hits++;
 
-		if (consumer) {
-			consumer->gpu_ops++;
-		}
-	}
-	else if (strcmp(event->name, "writeback_inode_dirty") == 0) {
-		static uint64_t prev_time;
-		class power_consumer *consumer = NULL;
-		int dev;
+		/* if the previous inode dirty was > 1 second ago, it becomes a hard hit */
+		if ((time - prev_time) > 1000000000)
+			consumer->hard_disk_hits++;
 
-		consumer = current_consumer(cpu);
+		prev_time = time;
+	}
+}
 
-		ret = tep_get_field_val(NULL, event, "dev", &rec, &val, 0);
-		if (ret < 0)
+static const struct trace_point_desc process_trace_points[] = {
+	{ "sched_switch",		handle_sched_switch,		{ "next_comm", "next_pid", "prev_pid" } },
+	{ "sched_wakeup",		handle_sched_wakeup,		{ "common_flags", "comm", "pid" } },
+	{ "irq_handler_entry",		handle_irq_handler_entry,	{ "name", "irq" } },
+	{ "irq_handler_exit",		handle_irq_exit,		{ } },
+	{ "softirq_entry",		handle_softirq_entry,		{ "vec" } },
+	{ "softirq_exit",		handle_irq_exit,		{ } },
+	{ "timer_expire_entry",		handle_timer_expire_entry,	{ "function", "timer" } },
+	{ "timer_expire_exit",		handle_timer_expire_exit,	{ "timer" } },
+	{ "hrtimer_expire_entry",	handle_hrtimer_expire_entry,	{ "function", "hrtimer" } },
+	{ "hrtimer_expire_exit",	handle_timer_expire_exit,	{ "hrtimer" } },
+	{ "workqueue_execute_start",	handle_workqueue_execute_start,	{ "function", "work" } },
+	{ "workqueue_execute_end",	handle_workqueue_execute_end,	{ "work" } },
+	{ "cpu_idle",			handle_cpu_idle,		{ "state" } },
+	{ "power_start",		handle_power_start,		{ } },
+	{ "power_end",			handle_power_end,		{ } },
+	{ "i915_gem_ring_dispatch",	handle_gpu_request,		{ "common_flags" } },
+	{ "i915_gem_request_submit",	handle_gpu_request,		{ "common_flags" } },
+	{ "writeback_inode_dirty",	handle_writeback_inode_dirty,	{ "dev" } },
+	{ NULL, NULL, { } }
+};
 
-			return;
-		dev = (int)val;
+class perf_process_bundle: public perf_bundle
+{
+public:
+	perf_process_bundle(void) : perf_bundle(process_trace_points) {};
+	virtual void handle_trace_point(void *trace, int cpu, uint64_t time);
+};
 
-		if (consumer && strcmp(consumer->name(),
-			"process")==0 && dev > 0) {
+void perf_process_bundle::handle_trace_point(void *trace, int cpu, uint64_t time)
+{
+	struct trace_dispatch *d;
 
-			consumer->disk_hits++;
+	d = find_dispatch(trace);
+	if (!d)
+		return;
 
-			/* if the previous inode dirty was > 1 second ago, it becomes a hard hit */
-			if ((time - prev_time) > 1000000000)
-				consumer->hard_disk_hits++;
+	if (time < first_stamp)
+		first_stamp = time;
 
-			prev_time = time;
-		}
+	if (time > last_stamp) {
+		last_stamp = time;
+		measurement_time = (0.0001 + last_stamp - first_stamp) / 1000000000 ;
 	}
+
+	if (d->handler)
+		d->handler(d, trace, cpu, time);
 }
 
 void start_process_measurement(void)
@@ -848,6 +948,10 @@ void process_update_display(void)
 
 	wprintw(win, "%s: %3.1f %s,  %3.1f %s, %3.1f %s %3.1f%% %s\n\n",_("Summary"), total_wakeups(), _("wakeups/second"), total_gpu_ops(), _("GPU ops/seconds"), total_disk_hits(), _("VFS ops/sec and"), total_cpu_time()*100, _("CPU use"));
 
+	if (lost_events)
+		wprintw(win, _("%llu trace events were lost, the data below is incomplete\n\n"),
+				(unsigned long long)lost_events);
+
 
 	if (show_power)
 		wprintw(win, "%s              %s       %s    %s       %s\n", _("Power est."), _("Usage"), _("Events/s"), _("Category"), _("Description"));
@@ -1055,7 +1159,7 @@ void report_summary(void)
 	init_title_attr(&title_attr);
 
 	/* Set array for summary */
-	int summary_size =12;
+	int summary_size = lost_events ? 14 : 12;
 	string *summary = new string [summary_size];
 	summary[0]=__("Target:");
 	summary[1]=__("1 units/s");
@@ -1074,6 +1178,14 @@ void report_summary(void)
 	summary[10]=__("VFS:");
 	summary[11]= double_to_string(total_disk_hits());
 	summary[11].append(__(" ops/s"));
+	if (lost_events) {
+		char lost[32];
+
+		snprintf(lost, sizeof(lost), "%llu", (unsigned long long)lost_events);
+		summary[12]=__("Lost:");
+		summary[13]=lost;
+		summary[13].append(__(" trace events"));
+	}
 
 	/* Set array of data in row Major order */
 	string *summary_data = new string[cols * (rows + 1)];
@@ -1170,6 +1282,8 @@ void process_process_data(void)
 
 	/* process data */
 	perf_events->process();
+	settle_consumers();
+	lost_events = perf_lost_records();
 	perf_events->clear();
 
 	run_devpower_list();
@@ -1229,5 +1343,6 @@ void clear_process_data(void)
 	if (perf_events)
 		perf_events->release();
 	delete perf_events;
+	clear_process_metadata_cache();
 }
 
@@ -25,6 +25,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <string>
+#include <unordered_set>
 #include "process.h"
 #include "interrupt.h"
 #include "../lib.h"
@@ -51,6 +53,7 @@ interrupt::interrupt(const char *_handler, int _number) : power_consumer()
 	number = _number;
 	pt_strcpy(handler, _handler);
 	raw_count = 0;
+	timer = strstr(handler, "timer") != NULL;
 	snprintf(desc, sizeof(desc), "[%i] %s", number, pretty_print(handler, buf, 128));
 }
 
@@ -92,25 +95,94 @@ const char * interrupt::usage_units_summary(void)
 }
 
 
+/*
+ * Hard irqs are looked up by irq number, and by cpu for the per-cpu "timer"
+ * handler. Only when that leaves more than one entry (a shared irq line) or
+ * none is the handler name interned and compared, by pointer. A line that
+ * only turns out to be shared later in a window is charged to its first
+ * handler until clear_interrupts(). Softirqs are indexed by vector directly.
+ */
+struct irq_slot_entry {
+	class interrupt	*irq;
+	const char	*handler;	/* interned */
+	int		cpu;	/* only for the per-cpu timer irq, -1 otherwise */
+};
+
+#define MAX_IRQ_NR	65536
+
+static vector< vector<struct irq_slot_entry> > irq_table;
+static vector<struct irq_slot_entry> stray_irqs;	/* nr outside the table */
+static class interrupt *softirq_table[10];
+
+static unordered_set<string> handler_names;
+static const char *timer_handler;
+
+static class interrupt *new_interrupt(const char *handler, int nr)
+{
+	class interrupt *new_irq;
+
+	new_irq = new class interrupt(handler, nr);
+	all_interrupts.push_back(new_irq);
+	return new_irq;
+}
+
 class interrupt * find_create_interrupt(const char *_handler, int nr, int cpu)
 {
 	char handler[64];
-	unsigned int i;
-	class interrupt *new_irq;
+	struct irq_slot_entry entry;
+	vector<struct irq_slot_entry> *slot;
+	struct irq_slot_entry *match = NULL;
+	unsigned int i, matches = 0;
+	bool timer;
+
+	if (!timer_handler)
+		timer_handler = handler_names.insert("timer").first->c_str();
+
+	if (nr < 0 || nr >= MAX_IRQ_NR) {
+		slot = &stray_irqs;
+	} else {
+		if (irq_table.size() <= (unsigned int)nr)
+			irq_table.resize(nr + 1);
+		slot = &irq_table[nr];
+	}
+
+	for (i = 0; i < slot->size(); i++) {
+		struct irq_slot_entry *e = &(*slot)[i];
+
+		if (e->irq->number != nr || (e->cpu >= 0 && e->cpu != cpu))
+			continue;
+		match = e;
+		matches++;
+	}
+	if (matches == 1)
+		return match->irq;
+
+	entry.handler = handler_names.insert(_handler).first->c_str();
+	timer = entry.handler == timer_handler;
+	entry.cpu = timer ? cpu : -1;
+
+	for (i = 0; matches && i < slot->size(); i++)
+		if ((*slot)[i].handler == entry.handler && (*slot)[i].cpu == entry.cpu &&
+		    (*slot)[i].irq->number == nr)
+			return (*slot)[i].irq;
 
 	pt_strcpy(handler, _handler);
-	if (strcmp(handler, "timer")==0)
+	if (timer)
 		sprintf(handler, "timer/%i", cpu);
 
+	entry.irq = new_interrupt(handler, nr);
+	slot->push_back(entry);
+	return entry.irq;
+}
 
-	for (i = 0; i < all_interrupts.size(); i++) {
-		if (all_interrupts[i] && all_interrupts[i]->number == nr && strcmp(handler, all_interrupts[i]->handler) == 0)
-			return all_interrupts[i];
-	}
+class interrupt * find_create_softirq(int vec)
+{
+	if (vec < 0 || vec > 9)
+		return NULL;
 
-	new_irq = new class interrupt(handler, nr);
-	all_interrupts.push_back(new_irq);
-	return new_irq;
+	if (!softirq_table[vec])
+		softirq_table[vec] = new_interrupt(softirqs[vec], vec);
+	return softirq_table[vec];
 }
 
 void all_interrupts_to_all_power(void)
@@ -123,9 +195,14 @@ void all_interrupts_to_all_power(void)
 
 void clear_interrupts(void)
 {
-	std::vector<class interrupt *>::iterator it = all_interrupts.begin();
-	while (it != all_interrupts.end()) {
-		delete *it;
-		it = all_interrupts.erase(it);
-	}
+	unsigned int i;
+
+	for (i = 0; i < all_interrupts.size(); i++)
+		delete all_interrupts[i];
+	all_interrupts.clear();
+
+	for (i = 0; i < irq_table.size(); i++)
+		irq_table[i].resize(0);
+	stray_irqs.resize(0);
+	memset(softirq_table, 0, sizeof(softirq_table));
 }
@@ -37,6 +37,7 @@ public:
 	int		number;
 
 	int		raw_count;
+	bool		timer;		/* handler name contains "timer" */
 
 	interrupt(const char *_handler, int _number);
 
@@ -56,6 +57,7 @@ extern const char* softirqs[];
 
 
 extern class interrupt * find_create_interrupt(const char *_handler, int nr, int cpu);
+extern class interrupt * find_create_softirq(int vec);
 extern void all_interrupts_to_all_power(void);
 extern void clear_interrupts(void);
 
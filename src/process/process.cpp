@@ -30,11 +30,14 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include <iostream>
 #include <fstream>
 #include <algorithm>
 #include <iterator>
+#include <map>
 #include "../lib.h"
 
 
@@ -78,13 +81,87 @@ static void cmdline_to_string(std::string& str)
 	std::replace(str.begin(), str.end(), '\0', ' ');
 }
 
+/*
+ * /proc metadata survives across measurement windows, so long running
+ * processes are only read once. An entry is only reused for the same
+ * process instance: same comm and same start time in /proc/<pid>/stat.
+ * The /proc/<pid> directory is created with the process, so as long as
+ * its ctime is unchanged the start time is too and one stat() of it
+ * replaces reading /proc/<pid>/stat.
+ */
+struct process_metadata {
+	unsigned long long	start_time;
+	struct timespec		ctime;
+	char			comm[16];
+	int			tgid;
+	int			is_kernel;
+	string			cmdline;
+	unsigned int		last_used;
+};
+
+static map<int, struct process_metadata> metadata_cache;
+static unsigned int metadata_generation;
+
+/* drop entries not used for this many process table resets (two per window) */
+#define METADATA_MAX_AGE	8
+
+unsigned long long read_pid_start_time(int pid)
+{
+	char filename[64];
+	char buf[1024];
+	unsigned long long start_time = 0;
+	char *c;
+	ssize_t len;
+	int fd, field;
+
+	snprintf(filename, sizeof(filename), "/proc/%i/stat", pid);
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
 
-process::process(const char *_comm, int _pid, int _tid) : power_consumer()
+	/* comm may contain spaces and parentheses; starttime is field 22 */
+	c = strrchr(buf, ')');
+	if (!c)
+		return 0;
+	for (field = 2; field < 22 && c; field++)
+		c = strchr(c + 1, ' ');
+	if (c)
+		start_time = strtoull(c + 1, NULL, 10);
+	return start_time;
+}
+
+static int read_tgid(int pid)
 {
 	char line[4097];
 	ifstream file;
-	ssize_t pos;
+	int tgid = 0;
+
+	sprintf(line, "/proc/%i/status", pid);
+	file.open(line);
+	while (file) {
+		file.getline(line, 4096);
+		line[4096] = '\0';
+		if (strstr(line, "Tgid")) {
+			char *c;
+			c = strchr(line, ':');
+			if (!c)
+				continue;
+			c++;
+			tgid = strtoull(c, NULL, 10);
+			break;
+		}
+	}
+	file.close();
+	return tgid;
+}
 
+process::process(const char *_comm, int _pid, int _tid) : power_consumer()
+{
 	pt_strcpy(comm, _comm);
 	pid = _pid;
 	is_idle = 0;
@@ -93,28 +170,26 @@ process::process(const char *_comm, int _pid, int _tid) : power_consumer()
 	waker = NULL;
 	is_kernel = 0;
 	tgid = _tid;
-
-	if (_tid == 0) {
-		sprintf(line, "/proc/%i/status", _pid);
-		file.open(line);
-		while (file) {
-			file.getline(line, 4096);
-			line[4096] = '\0';
-			if (strstr(line, "Tgid")) {
-				char *c;
-				c = strchr(line, ':');
-				if (!c)
-					continue;
-				c++;
-				tgid = strtoull(c, NULL, 10);
-				break;
-			}
-		}
-		file.close();
-	}
+	metadata_loaded = false;
+	desc[0] = '\0';
 
 	if (strncmp(_comm, "kondemand/", 10) == 0)
 		is_idle = 1;
+}
+
+void process::load_metadata(void)
+{
+	struct process_metadata *meta = NULL;
+	map<int, struct process_metadata>::iterator it;
+	unsigned long long start_time;
+	struct stat st;
+	ifstream file;
+	char line[64];
+	ssize_t pos;
+
+	if (metadata_loaded)
+		return;
+	metadata_loaded = true;
 
 	pos = snprintf(desc, sizeof(desc), "[PID %d] ", pid);
 
@@ -126,24 +201,78 @@ process::process(const char *_comm, int _pid, int _tid) : power_consumer()
 	strncpy(desc + pos, comm, sizeof(desc) - pos - 1);
 	desc[sizeof(desc) - 1] = '\0';
 
-	sprintf(line, "/proc/%i/cmdline", _pid);
-	file.open(line, ios::binary);
-	if (file) {
-		std::string cmdline(std::istreambuf_iterator<char>(file), (std::istreambuf_iterator<char>()));
-		file.close();
-		if (cmdline.size() < 1) {
-			is_kernel = 1;
-			snprintf(desc + pos, sizeof(desc) - pos, "[%s]", comm);
+	sprintf(line, "/proc/%i", pid);
+	if (stat(line, &st) < 0)
+		return;	/* already gone */
+
+	it = metadata_cache.find(pid);
+	if (it != metadata_cache.end() && strcmp(it->second.comm, comm) == 0 &&
+	    it->second.ctime.tv_sec == st.st_ctim.tv_sec &&
+	    it->second.ctime.tv_nsec == st.st_ctim.tv_nsec) {
+		meta = &it->second;
+	} else {
+		start_time = read_pid_start_time(pid);
+		if (!start_time)
+			return;
+
+		if (it != metadata_cache.end() && strcmp(it->second.comm, comm) == 0 &&
+		    it->second.start_time == start_time) {
+			/* same process, procfs just recreated its inode */
+			meta = &it->second;
 		} else {
+			sprintf(line, "/proc/%i/cmdline", pid);
+			file.open(line, ios::binary);
+			if (!file)
+				return;
+			std::string cmdline(std::istreambuf_iterator<char>(file), (std::istreambuf_iterator<char>()));
+			file.close();
+
+			meta = &metadata_cache[pid];
+			meta->start_time = start_time;
+			pt_strcpy(meta->comm, comm);
+			meta->tgid = read_tgid(pid);
+			meta->is_kernel = cmdline.size() < 1;
 			cmdline_to_string(cmdline);
-			strncpy(desc + pos, cmdline.c_str(), sizeof(desc) - pos - 1);
-			desc[sizeof(desc) - 1] = '\0';
+			meta->cmdline = cmdline;
 		}
+		meta->ctime = st.st_ctim;
+	}
+	meta->last_used = metadata_generation;
+
+	if (tgid == 0)
+		tgid = meta->tgid;
+
+	if (meta->is_kernel == 1) {
+		is_kernel = 1;
+		snprintf(desc + pos, sizeof(desc) - pos, "[%s]", comm);
+	} else {
+		strncpy(desc + pos, meta->cmdline.c_str(), sizeof(desc) - pos - 1);
+		desc[sizeof(desc) - 1] = '\0';
 	}
 }
 
+static void age_process_metadata(void)
+{
+	map<int, struct process_metadata>::iterator it;
+
+	metadata_generation++;
+	it = metadata_cache.begin();
+	while (it != metadata_cache.end()) {
+		if (metadata_generation - it->second.last_used > METADATA_MAX_AGE)
+			metadata_cache.erase(it++);
+		else
+			++it;
+	}
+}
+
+void clear_process_metadata_cache(void)
+{
+	metadata_cache.clear();
+}
+
 const char * process::description(void)
 {
+	load_metadata();
 
 	if (child_runtime > accumulated_runtime)
 		child_runtime = 0;
@@ -163,18 +292,69 @@ const char * process::usage_units_summary(void)
 	return "%";
 }
 
+/*
+ * Open addressing index over all_processes, keyed by pid (the comm is
+ * verified on lookup). Entries are never removed individually; the index
+ * is rebuilt whenever all_processes is pruned.
+ */
+static vector <class process *> process_index;
+static unsigned int process_index_used;
+
+static inline unsigned int pid_hash(int pid)
+{
+	return (unsigned int)pid * 2654435761U;
+}
+
+static void process_index_insert(class process *proc)
+{
+	unsigned int mask, slot;
+
+	mask = process_index.size() - 1;
+	slot = pid_hash(proc->pid) & mask;
+	while (process_index[slot])
+		slot = (slot + 1) & mask;
+	process_index[slot] = proc;
+	process_index_used++;
+}
+
+static void rebuild_process_index(unsigned int min_size)
+{
+	unsigned int i, size = 1024;
+
+	while (size < min_size * 2)
+		size *= 2;
+
+	process_index.assign(size, NULL);
+	process_index_used = 0;
+	for (i = 0; i < all_processes.size(); i++)
+		process_index_insert(all_processes[i]);
+}
+
 class process * find_create_process(const char *comm, int pid)
 {
-	unsigned int i;
+	unsigned int mask, slot;
 	class process *new_proc;
 
-	for (i = 0; i < all_processes.size(); i++) {
-		if (all_processes[i]->pid == pid && strcmp(comm, all_processes[i]->comm) == 0)
-			return all_processes[i];
+	if (process_index.empty())
+		rebuild_process_index(all_processes.size());
+
+	mask = process_index.size() - 1;
+	slot = pid_hash(pid) & mask;
+	while (process_index[slot]) {
+		if (process_index[slot]->pid == pid && strcmp(comm, process_index[slot]->comm) == 0)
+			return process_index[slot];
+		slot = (slot + 1) & mask;
 	}
 
 	new_proc = new class process(comm, pid);
 	all_processes.push_back(new_proc);
+
+	/* keep the load factor at or below one half */
+	if ((process_index_used + 1) * 2 > process_index.size())
+		rebuild_process_index(all_processes.size());
+	else
+		process_index_insert(new_proc);
+
 	return new_proc;
 }
 
@@ -205,8 +385,10 @@ void merge_processes(void)
 	while (it1 != all_processes.end()) {
 		it2 = it1 + 1;
 		one = *it1;
+		one->load_metadata();
 		while (it2 != all_processes.end()) {
 			two = *it2;
+			two->load_metadata();
 			/* fold threads */
 			if (one->pid == two->tgid && two->tgid != 0) {
 				merge_process(one, two);
@@ -225,6 +407,8 @@ void merge_processes(void)
 		}
 		++it1;
 	}
+
+	rebuild_process_index(all_processes.size());
 }
 
 void all_processes_to_all_power(void)
@@ -238,9 +422,12 @@ void all_processes_to_all_power(void)
 
 void clear_processes(void)
 {
-	std::vector <class process *>::iterator it = all_processes.begin();
-	while (it != all_processes.end()) {
-		delete *it;
-		it = all_processes.erase(it);
-	}
+	unsigned int i;
+
+	for (i = 0; i < all_processes.size(); i++)
+		delete all_processes[i];
+	all_processes.clear();
+
+	rebuild_process_index(0);
+	age_process_metadata();
 }
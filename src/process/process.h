@@ -41,7 +41,9 @@ Need to collect
  */
 class process : public power_consumer {
 	uint64_t	running_since;
+	bool		metadata_loaded;
 public:
+	/* desc, tgid and is_kernel come from /proc; call load_metadata() first */
 	char		desc[256];
 	int		tgid;
 	char		comm[16];
@@ -54,6 +56,8 @@ public:
 
 	process(const char *_comm, int _pid, int _tid = 0);
 
+	void load_metadata(void);
+
 	virtual void schedule_thread(uint64_t time, int thread_id);
 	virtual uint64_t deschedule_thread(uint64_t time, int thread_id = 0);
 
@@ -85,6 +89,8 @@ extern class process * find_create_process(char *comm, int pid);
 extern void all_processes_to_all_power(void);
 
 extern void clear_processes(void);
+extern void clear_process_metadata_cache(void);
+extern unsigned long long read_pid_start_time(int pid);
 extern void process_update_display(void);
 extern void report_process_update_display(void);
 extern void report_summary(void);
@@ -23,11 +23,14 @@
  *	Arjan van de Ven <arjan@linux.intel.com>
  */
 #include <map>
+#include <unordered_set>
+#include <string>
 #include <utility>
 
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
 
 #include "timer.h"
 #include "../lib.h"
@@ -35,28 +38,77 @@
 
 using namespace std;
 
-static bool timer_is_deferred(const char *handler)
+/*
+ * Names of the functions that appear on deferrable ("D,") lines of
+ * /proc/timer_stats, parsed once per measurement window. Kernels since
+ * 4.11 no longer have the file; after the first failed open we stop
+ * looking for it.
+ */
+static unordered_set<string> deferred_handlers;
+static bool deferred_handlers_loaded;
+static bool timer_stats_missing;
+
+static void add_deferred_handler(const char *start, size_t len)
+{
+	char handler[32];
+
+	deferred_handlers.insert(string(start, len));
+
+	/* timer::handler is truncated, match that as well */
+	if (len >= sizeof(handler)) {
+		pt_strcpy(handler, string(start, len).c_str());
+		deferred_handlers.insert(handler);
+	}
+}
+
+static void load_deferred_handlers(void)
 {
 	FILE    *file;
-	bool    ret = false;
 	char    line[4096];
+	char	*c, *start;
+
+	deferred_handlers_loaded = true;
+	deferred_handlers.clear();
+
+	if (timer_stats_missing)
+		return;
 
-	file = fopen("/proc/timer_stats", "r");	
+	file = fopen("/proc/timer_stats", "r");
 	if (!file) {
-		return ret;
+		timer_stats_missing = true;
+		return;
 	}
 
 	while (!feof(file)) {
 		if (fgets(line, 4096, file) == NULL)
 			break;
-		if (strstr(line, handler)) {
-			ret = (strstr(line, "D,") != NULL);
-			if (ret == true)
-				break;
+		if (strstr(line, "D,") == NULL)
+			continue;
+
+		/* remember every identifier on the line */
+		c = line;
+		while (*c) {
+			while (*c && !(isalnum(*c) || *c == '_' || *c == '.'))
+				c++;
+			start = c;
+			while (*c && (isalnum(*c) || *c == '_' || *c == '.'))
+				c++;
+			if (c > start)
+				add_deferred_handler(start, c - start);
 		}
 	}
 	fclose(file);
-	return ret;
+}
+
+static bool timer_is_deferred(const char *handler)
+{
+	if (!deferred_handlers_loaded)
+		load_deferred_handlers();
+
+	if (deferred_handlers.empty())
+		return false;
+
+	return deferred_handlers.find(handler) != deferred_handlers.end();
 }
 
 timer::timer(unsigned long address) : power_consumer()
@@ -151,6 +203,7 @@ void clear_timers(void)
 		it = all_timers.begin();
 	}
 	running_since.clear();
+	deferred_handlers_loaded = false;
 }
 
 bool timer::is_deferred(void)
@@ -50,12 +50,50 @@ report_formatter_string_base::clear_result()
 
 /* ************************************************************************ */
 
+/*
+ * With an output file set, the document is written out as it is built
+ * instead of being kept in memory: whenever REPORT_FLUSH_SIZE bytes are
+ * pending, and at the end of every section. get_result() then only returns
+ * what hasn't been written yet.
+ */
+#define REPORT_FLUSH_SIZE (64 * 1024)
+
+void
+report_formatter_string_base::set_output(FILE *file)
+{
+	output = file;
+}
+
+void
+report_formatter_string_base::write_pending()
+{
+	if (!output || result.empty())
+		return;
+
+	fwrite(result.data(), 1, result.size(), output);
+	result.clear();
+}
+
+void
+report_formatter_string_base::flush_result()
+{
+	if (!output)
+		return;
+
+	write_pending();
+	fflush(output);
+}
+
+/* ************************************************************************ */
+
 void
 report_formatter_string_base::add(const char *str)
 {
 	assert(str);
 
-	result += escape_string(str);
+	escape_string(str, result);
+	if (result.size() >= REPORT_FLUSH_SIZE)
+		write_pending();
 }
 
 /* ************************************************************************ */
@@ -65,7 +103,9 @@ report_formatter_string_base::add_exact(const char *str)
 {
 	assert(str);
 
-	result += std::string(str);
+	result += str;
+	if (result.size() >= REPORT_FLUSH_SIZE)
+		write_pending();
 }
 
 /* ************************************************************************ */
@@ -31,8 +31,12 @@
 class report_formatter_string_base: public report_formatter
 {
 public:
+	report_formatter_string_base() : output(NULL) {}
+
 	virtual const char *get_result();
 	virtual void clear_result();
+	virtual void set_output(FILE *file);
+	virtual void flush_result();
 
 	virtual void add(const char *str);
 	virtual void addv(const char *fmt, va_list ap);
@@ -44,9 +48,11 @@ protected:
 	void addf_exact(const char *fmt, ...)
 				__attribute__ ((format (printf, 2, 3)));
 
-	virtual std::string escape_string(const char *str) = 0;
+	virtual void escape_string(const char *str, std::string &res) = 0;
+	void write_pending();
 
 	std::string result;
+	FILE *output;
 };
 
 #endif /* _REPORT_FORMATTER_BASE_H_ */
@@ -48,11 +48,9 @@ report_formatter_csv::finish_report()
 }
 
 
-string
-report_formatter_csv::escape_string(const char *str)
+void
+report_formatter_csv::escape_string(const char *str, string &res)
 {
-	string res;
-
 	assert(str);
 
 	for (const char *i = str; *i; i++) {
@@ -70,8 +68,6 @@ report_formatter_csv::escape_string(const char *str)
 
 		res += *i;
 	}
-
-	return res;
 }
 
 
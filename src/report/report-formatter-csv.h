@@ -65,7 +65,7 @@ public:
 
 private:
 	void add_quotes();
-	string escape_string(const char *str);
+	void escape_string(const char *str, string &res);
 	bool csv_need_quotes;
 	size_t text_start;
 };
@@ -98,11 +98,9 @@ report_formatter_html::add_doc_footer()
 }
 
 /* ************************************************************************ */
-string
-report_formatter_html::escape_string(const char *str)
+void
+report_formatter_html::escape_string(const char *str, string &res)
 {
-	string res;
-
 	assert(str);
 
 	for (const char *i = str; *i; i++) {
@@ -128,8 +126,6 @@ report_formatter_html::escape_string(const char *str)
 
 		res += *i;
 	}
-
-	return res;
 }
 
 
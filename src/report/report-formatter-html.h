@@ -66,7 +66,7 @@ private:
 	void init_markup();
 	void add_doc_header();
 	void add_doc_footer();
-	string escape_string(const char *str);
+	void escape_string(const char *str, string &res);
 
 };
 
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2026, the PowerTOP contributors
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ *
+ *
+ * JSON lines report generator: one object per measurement window.
+ */
+
+/* Uncomment to disable asserts */
+/*#define NDEBUG*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <algorithm>
+
+#include "report-formatter-json.h"
+#include "report-data-html.h"
+
+/* ************************************************************************ */
+
+report_formatter_json::report_formatter_json()
+{
+	start = time(NULL);
+	section = "default";
+}
+
+/* ************************************************************************ */
+
+void
+report_formatter_json::clear_result()
+{
+	report_formatter_string_base::clear_result();
+	start = time(NULL);
+	section = "default";
+	title.clear();
+	section_ids.clear();
+	sections.clear();
+}
+
+/* ************************************************************************ */
+
+void
+report_formatter_json::finish_report()
+{
+	string line;
+	unsigned int i;
+	char buf[64];
+
+	line = "{\"version\":\"";
+	escape_string(PACKAGE_VERSION, line);
+	snprintf(buf, sizeof(buf), "\",\"time\":%lld,\"sections\":{", (long long)start);
+	line += buf;
+
+	for (i = 0; i < section_ids.size(); i++) {
+		if (i)
+			line += ',';
+		line += '"';
+		escape_string(section_ids[i].c_str(), line);
+		line += "\":[";
+		line += sections[section_ids[i]];
+		line += ']';
+	}
+	line += "}}\n";
+
+	add_exact(line.c_str());
+
+	section_ids.clear();
+	sections.clear();
+}
+
+/* ************************************************************************ */
+
+void
+report_formatter_json::escape_string(const char *str, string &res)
+{
+	char buf[8];
+
+	assert(str);
+
+	for (const char *i = str; *i; i++) {
+		switch (*i) {
+			case '"':
+				res += "\\\"";
+				continue;
+			case '\\':
+				res += "\\\\";
+				continue;
+			case '\n':
+				res += "\\n";
+				continue;
+			case '\t':
+				res += "\\t";
+				continue;
+		}
+
+		if ((unsigned char)*i < 0x20) {
+			snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)*i);
+			res += buf;
+			continue;
+		}
+		res += *i;
+	}
+}
+
+/* ************************************************************************ */
+
+/* base unit scale for an SI prefixed unit such as "mW", 0 if not a unit */
+static double unit_scale(const char *unit)
+{
+	static const char *units[] = { "W", "J", "s", "Hz", "B", NULL };
+	double scale = 1.0;
+	int i;
+
+	if (!*unit || !strcmp(unit, "%") || unit[0] == '/')
+		return 1.0;
+
+	for (i = 0; units[i]; i++)
+		if (!strcmp(unit, units[i]))
+			return 1.0;
+
+	if (!strncmp(unit, "\xc2\xb5", 2)) {	/* UTF-8 micro sign */
+		scale = 1e-6;
+		unit += 2;
+	} else {
+		switch (*unit) {
+		case 'p': scale = 1e-12; break;
+		case 'n': scale = 1e-9; break;
+		case 'u': scale = 1e-6; break;
+		case 'm': scale = 1e-3; break;
+		case 'k':
+		case 'K': scale = 1e3; break;
+		case 'M': scale = 1e6; break;
+		case 'G': scale = 1e9; break;
+		case 'T': scale = 1e12; break;
+		default: return 0;
+		}
+		unit++;
+	}
+
+	for (i = 0; units[i]; i++)
+		if (!strcmp(unit, units[i]))
+			return scale;
+	return 0;
+}
+
+void
+report_formatter_json::add_value(string &res, const string &cell)
+{
+	const char *str = cell.c_str();
+	char *end, unit[16];
+	double value, scale;
+	size_t len;
+	char buf[64];
+
+	while (*str == ' ')
+		str++;
+
+	if ((isdigit(*str) || ((*str == '-' || *str == '+' || *str == '.') && isdigit(str[1]))) &&
+	    !strpbrk(str, "xX")) {
+		value = strtod(str, &end);
+		while (*end == ' ')
+			end++;
+
+		len = strlen(end);
+		while (len && end[len - 1] == ' ')
+			len--;
+
+		if (len < sizeof(unit)) {
+			memcpy(unit, end, len);
+			unit[len] = 0;
+			scale = unit_scale(unit);
+			if (scale != 0) {
+				snprintf(buf, sizeof(buf), "%.9g", value * scale);
+				res += buf;
+				return;
+			}
+		}
+	}
+
+	res += '"';
+	escape_string(cell.c_str(), res);
+	res += '"';
+}
+
+/* ************************************************************************ */
+
+void
+report_formatter_json::add_item(const string &item)
+{
+	string &body = sections[section];
+
+	if (body.empty() && find(section_ids.begin(), section_ids.end(), section) == section_ids.end())
+		section_ids.push_back(section);
+	if (!body.empty())
+		body += ',';
+	body += item;
+}
+
+void
+report_formatter_json::add_div(struct tag_attr *div_attr)
+{
+	if (div_attr->css_id && *div_attr->css_id)
+		section = div_attr->css_id;
+	else if (div_attr->css_class && *div_attr->css_class)
+		section = div_attr->css_class;
+	else
+		section = "default";
+	title.clear();
+}
+
+void
+report_formatter_json::end_div()
+{
+	section = "default";
+	title.clear();
+}
+
+void
+report_formatter_json::add_title(struct tag_attr *title_att, const char *title_str)
+{
+	title = title_str;
+}
+
+void
+report_formatter_json::add_summary_list(string *list, int size)
+{
+	string item;
+	int i;
+
+	item = "{\"summary\":{";
+	for (i = 0; i + 1 < size; i += 2) {
+		if (i)
+			item += ',';
+		item += '"';
+		escape_string(list[i].c_str(), item);
+		item += "\":";
+		add_value(item, list[i + 1]);
+	}
+	item += "}}";
+	title.clear();
+	add_item(item);
+}
+
+void
+report_formatter_json::add_table(string *system_data, struct table_attributes *tb_attr)
+{
+	int rows = tb_attr->rows, cols = tb_attr->cols;
+	bool header_row, pairs;
+	string item;
+	int i, j, first;
+
+	/* a header row is only usable as keys if every column has a title */
+	header_row = (tb_attr->pos_table_title == T || tb_attr->pos_table_title == TL) && rows > 1;
+	for (j = 0; header_row && j < cols; j++) {
+		if (system_data[j].empty() || system_data[j] == "&nbsp;")
+			header_row = false;
+		for (i = 0; header_row && i < j; i++)
+			if (system_data[i] == system_data[j])
+				header_row = false;
+	}
+	pairs = !header_row && cols == 2 && tb_attr->pos_table_title == L;
+
+	item = "{";
+	if (!title.empty()) {
+		item += "\"title\":\"";
+		escape_string(title.c_str(), item);
+		item += "\",";
+	}
+	item += pairs ? "\"values\":{" : "\"rows\":[";
+
+	first = 1;
+	for (i = header_row ? 1 : 0; i < rows; i++) {
+		const string *row = &system_data[i * cols];
+
+		for (j = 0; j < cols; j++)
+			if (row[j] != "&nbsp;" && !row[j].empty())
+				break;
+		if (j == cols)
+			continue;
+
+		if (!first)
+			item += ',';
+		first = 0;
+
+		if (pairs) {
+			item += '"';
+			escape_string(row[0].c_str(), item);
+			item += "\":";
+			add_value(item, row[1]);
+			continue;
+		}
+
+		item += header_row ? '{' : '[';
+		for (j = 0; j < cols; j++) {
+			if (j)
+				item += ',';
+			if (header_row) {
+				item += '"';
+				escape_string(system_data[j].c_str(), item);
+				item += "\":";
+			}
+			if (row[j] == "&nbsp;")
+				item += "null";
+			else
+				add_value(item, row[j]);
+		}
+		item += header_row ? '}' : ']';
+	}
+	item += pairs ? "}}" : "]}";
+
+	/* a title applies to the table following it */
+	title.clear();
+	add_item(item);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2026, the PowerTOP contributors
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ *
+ *
+ * JSON lines report generator: one object per measurement window.
+ */
+
+#ifndef _REPORT_FORMATTER_JSON_H_
+#define _REPORT_FORMATTER_JSON_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <time.h>
+
+#include "report-formatter-base.h"
+
+using namespace std;
+
+/* ************************************************************************ */
+
+/*
+ * Each report (one measurement window) becomes a single line:
+ *	{"version":..., "time":..., "sections":{"<div id>":[<table>, ...], ...}}
+ * Tables with a header row become arrays of objects keyed by the (never
+ * translated) column titles, two column tables become one object, others
+ * arrays of cells. Cells holding a number, optionally with a unit, are
+ * emitted as numbers in the base unit (W, s, Hz; % stays as is).
+ */
+class report_formatter_json: public report_formatter_string_base
+{
+public:
+	report_formatter_json();
+	void finish_report();
+	void clear_result();
+
+	/* Report Style */
+	void add_div(struct tag_attr *div_attr);
+	void end_div();
+	void add_title(struct tag_attr *title_att, const char *title);
+	void add_summary_list(string *list, int size);
+	void add_table(string *system_data, struct table_attributes *tb_attr);
+
+private:
+	void escape_string(const char *str, string &res);
+	void add_value(string &res, const string &cell);
+	void add_item(const string &item);
+
+	time_t start;
+	string section;
+	string title;
+	vector<string> section_ids;		/* in order of appearance */
+	map<string, string> sections;		/* id -> comma separated tables */
+};
+
+#endif /* _REPORT_FORMATTER_JSON_H_ */
@@ -37,6 +37,8 @@ public:
 	virtual void finish_report() {}
 	virtual const char *get_result() {return "Basic report_formatter::get_result() call\n";}
 	virtual void clear_result() {}
+	virtual void set_output(FILE *file) {}
+	virtual void flush_result() {}
 
 	virtual void add(const char *str) {}
 	virtual void addv(const char *fmt, va_list ap) {}
@@ -32,6 +32,7 @@
 #include "report-maker.h"
 #include "report-formatter-csv.h"
 #include "report-formatter-html.h"
+#include "report-formatter-json.h"
 
 /* ************************************************************************ */
 
@@ -76,6 +77,23 @@ report_maker::clear_result()
 
 /* ************************************************************************ */
 
+/* write the report to file as it is generated, see report_formatter_string_base */
+void
+report_maker::set_output(FILE *file)
+{
+	formatter->set_output(file);
+}
+
+/* ************************************************************************ */
+
+void
+report_maker::flush_result()
+{
+	formatter->flush_result();
+}
+
+/* ************************************************************************ */
+
 report_type
 report_maker::get_type()
 {
@@ -103,6 +121,8 @@ report_maker::setup_report_formatter()
 		formatter = new report_formatter_html();
 	else if (type == REPORT_CSV)
 		formatter = new report_formatter_csv();
+	else if (type == REPORT_JSON)
+		formatter = new report_formatter_json();
 	else if (type == REPORT_OFF)
 		formatter = new report_formatter();
 	else
@@ -165,6 +185,8 @@ void
 report_maker::end_div()
 {
 	formatter->end_div();
+	/* sections are complete at this point, get them on disk */
+	formatter->flush_result();
 }
 
 void
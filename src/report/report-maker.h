@@ -59,13 +59,14 @@
  */
 
 #include <stdarg.h>
+#include <stdio.h>
 
 #include <string>
 using namespace std;
-/* Conditional gettext. We need original strings for CSV. */
+/* Conditional gettext. We need original strings for CSV and JSON. */
 #ifdef ENABLE_NLS
 #define __(STRING) \
-	((report.get_type() == REPORT_CSV) ? (STRING) : gettext(STRING))
+	((report.get_type() != REPORT_HTML) ? (STRING) : gettext(STRING))
 #else
 #define __(STRING) (STRING)
 #endif
@@ -79,7 +80,8 @@ using namespace std;
 enum report_type {
 	REPORT_OFF,
 	REPORT_HTML,
-	REPORT_CSV
+	REPORT_CSV,
+	REPORT_JSON
 };
 
 /* ************************************************************************ */
@@ -117,6 +119,8 @@ public:
 	void finish_report();
 	const char *get_result();
 	void clear_result();
+	void set_output(FILE *file);
+	void flush_result();
 
 	void add(const char *str);
 
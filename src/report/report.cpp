@@ -36,6 +36,9 @@
 #include <malloc.h>
 #include <unistd.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include "report-data-html.h"
 
 using namespace std;
@@ -166,6 +169,116 @@ static void system_info(void)
 	delete [] system_data;
 }
 
+/*
+ * Reports whose name ends in .gz are written through gzip. It runs as a
+ * separate process, so compression overlaps with the measurements and
+ * powertop itself doesn't need zlib.
+ *
+ * If gzip dies, writes to the pipe must fail with EPIPE rather than kill
+ * powertop; an empty handler (unlike SIG_IGN, not inherited by the
+ * programs we exec) takes care of SIGPIPE.
+ */
+static void sigpipe_handler(int sig)
+{
+}
+
+static FILE *open_compressed(const char *filename)
+{
+	int fd, pipefd[2], status[2], err;
+	struct sigaction sa;
+	pid_t pid;
+	FILE *file;
+	ssize_t ret;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0)
+		return NULL;
+
+	if (pipe2(pipefd, O_CLOEXEC)) {
+		close(fd);
+		return NULL;
+	}
+	/* closed by a successful exec, or carries the errno of a failed one */
+	if (pipe2(status, O_CLOEXEC)) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+		close(fd);
+		return NULL;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		dup2(pipefd[0], STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		execlp("gzip", "gzip", "-c", NULL);
+		err = errno;
+		ret = write(status[1], &err, sizeof(err));
+		_exit(127);
+	}
+	close(pipefd[0]);
+	close(status[1]);
+	close(fd);
+
+	if (pid < 0) {
+		close(status[0]);
+		close(pipefd[1]);
+		unlink(filename);
+		return NULL;
+	}
+
+	do {
+		ret = read(status[0], &err, sizeof(err));
+	} while (ret < 0 && errno == EINTR);
+	close(status[0]);
+	if (ret > 0) {
+		close(pipefd[1]);
+		waitpid(pid, NULL, 0);
+		unlink(filename);
+		errno = err;
+		return NULL;
+	}
+
+	file = fdopen(pipefd[1], "w");
+	if (!file) {
+		close(pipefd[1]);
+		waitpid(pid, NULL, 0);
+		unlink(filename);
+		return NULL;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigpipe_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPIPE, &sa, NULL);
+
+	reportout.compressor = pid;
+	return file;
+}
+
+/* returns 0 if gzip compressed everything */
+static int close_compressed(FILE *file)
+{
+	int status, ret = 0;
+
+	if (ferror(file))
+		ret = -1;
+	if (fclose(file))
+		ret = -1;
+	while (waitpid(reportout.compressor, &status, 0) < 0)
+		if (errno != EINTR)
+			return -1;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		ret = -1;
+	return ret;
+}
+
+static bool compressed_name(const char *filename)
+{
+	size_t len = strlen(filename);
+
+	return len > 3 && !strcmp(filename + len - 3, ".gz");
+}
+
 void init_report_output(char *filename_str, int iterations)
 {
 	size_t period;
@@ -173,6 +286,24 @@ void init_report_output(char *filename_str, int iterations)
 	time_t stamp;
 	char datestr[200];
 
+	/* JSON lines: every window goes to the same file, kept open, or stdout */
+	if (reporttype == REPORT_JSON) {
+		if (!reportout.report_file) {
+			snprintf(reportout.filename, sizeof(reportout.filename), "%s", filename_str);
+			if (!strcmp(filename_str, "-"))
+				reportout.report_file = stdout;
+			else
+				reportout.report_file = fopen(reportout.filename, "a");
+			if (!reportout.report_file)
+				fprintf(stderr, _("Cannot open output file %s (%s)\n"),
+					reportout.filename, strerror(errno));
+		}
+		report.set_type(reporttype);
+		report.set_output(reportout.report_file);
+		system_info();
+		return;
+	}
+
 	if (iterations == 1)
 		snprintf(reportout.filename, sizeof(reportout.filename), "%s", filename_str);
 	else
@@ -190,13 +321,26 @@ void init_report_output(char *filename_str, int iterations)
 			filename.substr(period).c_str());
 	}
 	
-	reportout.report_file = fopen(reportout.filename, "wm");
+	reportout.compressor = 0;
+	reportout.report_file = NULL;
+	if (compressed_name(reportout.filename)) {
+		reportout.report_file = open_compressed(reportout.filename);
+		if (!reportout.report_file) {
+			/* no gzip: keep the report, just uncompressed */
+			fprintf(stderr, _("Cannot compress %s (%s), writing it uncompressed\n"),
+				reportout.filename, strerror(errno));
+			reportout.filename[strlen(reportout.filename) - 3] = '\0';
+		}
+	}
+	if (!reportout.report_file)
+		reportout.report_file = fopen(reportout.filename, "wm");
 	if (!reportout.report_file) {
 		fprintf(stderr, _("Cannot open output file %s (%s)\n"),
 			reportout.filename, strerror(errno));
 	}
 
 	report.set_type(reporttype);
+	report.set_output(reportout.report_file);
 	system_info();
 }
 
@@ -206,12 +350,25 @@ void finish_report_output(void)
 		return;
 
 	report.finish_report();
+	if (reporttype == REPORT_JSON) {
+		report.flush_result();
+		report.clear_result();
+		return;
+	}
 	if (reportout.report_file)
 	{
 		fprintf(stderr, _("PowerTOP outputting using base filename %s\n"), reportout.filename);
-		fputs(report.get_result(), reportout.report_file);
-		fdatasync(fileno(reportout.report_file));
-		fclose(reportout.report_file);
+		report.flush_result();
+		if (reportout.compressor) {
+			if (close_compressed(reportout.report_file))
+				fprintf(stderr, _("Compressing %s failed\n"), reportout.filename);
+		} else {
+			fdatasync(fileno(reportout.report_file));
+			fclose(reportout.report_file);
+		}
+		reportout.report_file = NULL;
+		reportout.compressor = 0;
 	}
+	report.set_output(NULL);
 	report.clear_result();
 }
@@ -28,6 +28,7 @@
 #include <string>
 #include <stdio.h>
 #include <limits.h>
+#include <sys/types.h>
 
 #include "report-maker.h"
 
@@ -36,6 +37,7 @@ using namespace std;
 struct reportstream {
 	FILE *report_file;
 	char filename[PATH_MAX];
+	pid_t compressor;	/* gzip writing a .gz report, or 0 */
 };
 
 extern report_type reporttype;
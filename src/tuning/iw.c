@@ -38,6 +38,7 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "nl80211.h"
 #include <netlink/genl/genl.h>
@@ -281,23 +282,30 @@ int set_wifi_power_saving(const char *iface, int state)
 }
 
 
+/* enable_power_save is shared, and nics take their snapshots in parallel */
+static pthread_mutex_t power_save_lock = PTHREAD_MUTEX_INITIALIZER;
+
 int get_wifi_power_saving(const char *iface)
 {
 	struct nl80211_state nlstate;
 	int err;
+	int ret;
 
+	pthread_mutex_lock(&power_save_lock);
 	enable_power_save = 0;
 
 	err = nl80211_init(&nlstate);
-	if (err)
+	if (err) {
+		pthread_mutex_unlock(&power_save_lock);
 		return 1;
+	}
 
 	err = __handle_cmd(&nlstate, iface, 1);
 
 	nl80211_cleanup(&nlstate);
 
-	if (err) /* not a wifi interface */
-		return 1;
+	ret = err ? 1 : enable_power_save;	/* err: not a wifi interface */
+	pthread_mutex_unlock(&power_save_lock);
 
-	return enable_power_save;
+	return ret;
 }